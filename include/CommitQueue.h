@@ -0,0 +1,92 @@
+#pragma once
+
+#include "Wrapper.h"
+
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace libgit2pp {
+
+/**
+ Create commits on one reference on behalf of many threads.
+
+ Requests are queued and handled by a background thread. Requests that
+ are queued together are committed as a chain, each commit being the
+ parent of the next, once the trees of the whole chain are built. The
+ reference then moves through the chain with a reflog entry per commit,
+ like it would for separate commits. Trees written by a commit are reused
+ by the next one through the tree cache of the repository.
+*/
+class CommitQueue {
+ public:
+  /**
+   @param repo the repository to commit to. It must not be used by
+          other threads while the queue exists.
+   @param updateRef name of the reference to update, e.g. "HEAD".
+   @param maxBatchSize the maximum number of commits chained before the
+          reference is updated.
+  */
+  CommitQueue(
+      Repository* repo,
+      const std::string& updateRef,
+      size_t maxBatchSize = 64);
+
+  // Commit the requests left in the queue, then stop.
+  ~CommitQueue();
+
+  /**
+   Queue a commit, see Repository::commit().
+
+   @returns a future of the hex SHA of the new commit, which becomes
+            ready once the reference points to it or one of its
+            descendants. The SHA is empty if the commit fails.
+  */
+  std::future<std::string> submit(
+      const std::string& authorName,
+      const std::string& authorEmail,
+      const std::string& message,
+      const std::unordered_map<std::string, std::string>& additions,
+      const std::unordered_set<std::string>& deletions);
+
+ private:
+  struct Request {
+    std::string authorName;
+    std::string authorEmail;
+    std::string message;
+    std::unordered_map<std::string, std::string> additions;
+    std::unordered_set<std::string> deletions;
+    std::promise<std::string> result;
+  };
+
+  Repository* repo_;
+  const std::string updateRef_;
+  const size_t maxBatchSize_;
+
+  std::deque<Request> requests_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stop_;
+  std::thread thread_;
+
+  void run();
+
+  // Commit a batch and update the reference. Returns false if the
+  // reference was moved by someone else in the meantime, after handing
+  // out the results of the commits it moved to before.
+  bool commitBatch(std::deque<Request>& batch, std::vector<std::string>* ids);
+
+  // Repository::updateReference(), retried while the reference is locked.
+  int updateReference(
+      const std::string& refName,
+      const git_oid* id,
+      const git_oid* old,
+      const std::string& logMessage);
+};
+
+} // libgit2pp
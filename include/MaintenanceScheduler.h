@@ -0,0 +1,94 @@
+#pragma once
+
+#include "Wrapper.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace libgit2pp {
+
+// What the maintenance of a repository did.
+struct MaintenanceReport {
+  // Number of times the repository was maintained.
+  size_t runs = 0;
+  // Loose objects moved into a pack.
+  size_t objectsPacked = 0;
+  // Small packs merged into a larger one.
+  size_t packsConsolidated = 0;
+  // Disk space freed, which is negative if the new packs are larger.
+  long long bytesSaved = 0;
+  std::chrono::milliseconds timeSpent{0};
+};
+
+/**
+ Keep the object database of a repository compact in the background.
+
+ Each commit writes its objects as loose files, which makes lookups
+ slower as they pile up. Once there are @param maxLooseObjects loose
+ objects, a background thread writes them to a new pack with the
+ packbuilder and deletes them. Once there are @param maxSmallPacks packs
+ smaller than @param smallPackSize, they are merged into one pack.
+
+ The thread works through its own repository handle and only deletes
+ objects after they are in a pack, so commits are not blocked.
+*/
+class MaintenanceScheduler {
+ public:
+  /**
+   Start maintaining the repository of @param repo, which is notified
+   of new objects with Repository::setMaintenanceScheduler().
+
+   @param interval how often the repository is checked without
+          notifications, for objects written by other processes.
+
+   Throws an exception if the repository can't be opened.
+  */
+  MaintenanceScheduler(
+      Repository* repo,
+      size_t maxLooseObjects = 4096,
+      size_t maxSmallPacks = 8,
+      size_t smallPackSize = 32 * 1024 * 1024,
+      std::chrono::milliseconds interval = std::chrono::seconds(10));
+
+  // Stop the thread, waiting for a run in progress to finish.
+  ~MaintenanceScheduler();
+
+  // Tell the scheduler that about @param objects loose objects were
+  // written.
+  void notify(size_t objects);
+
+  // Maintain the repository now, on the calling thread. Returns what was
+  // done by this run.
+  MaintenanceReport runOnce();
+
+  // Get what was done by all runs so far.
+  MaintenanceReport getReport();
+
+ private:
+  const std::string objectsDir_;
+  const size_t maxLooseObjects_;
+  const size_t maxSmallPacks_;
+  const size_t smallPackSize_;
+  const std::chrono::milliseconds interval_;
+
+  // Used by one run at a time.
+  std::unique_ptr<Repository> repo_;
+  std::mutex runMutex_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  // Loose objects written since they were last counted.
+  size_t pending_;
+  bool stop_;
+  MaintenanceReport total_;
+
+  std::thread thread_;
+
+  void run();
+};
+
+} // libgit2pp
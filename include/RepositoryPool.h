@@ -0,0 +1,90 @@
+#pragma once
+
+#include "Wrapper.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace libgit2pp {
+
+/**
+ A pool of repository handles for many threads.
+
+ A Repository must not be used by two threads at once, but opening one
+ for every request is expensive. The pool opens handles without
+ searching for the repository, and all of them share one object
+ database: its open packs, and the raw objects it caches, are shared
+ by the threads. Parsed commits and trees are cached by each handle,
+ which keeps its caches while it is in the pool.
+*/
+class RepositoryPool {
+ public:
+  // A handle checked out from the pool. It goes back to the pool when
+  // destroyed.
+  class Handle {
+   public:
+    Handle(RepositoryPool* pool, std::unique_ptr<Repository> repo)
+      : pool_(pool), repo_(std::move(repo)) {}
+
+    Handle(Handle&& b) = default;
+
+    ~Handle() {
+      if (repo_) {
+        pool_->checkin(std::move(repo_));
+      }
+    }
+
+    Repository* get() { return repo_.get(); }
+    Repository* operator->() { return repo_.get(); }
+    Repository& operator*() { return *repo_; }
+
+   private:
+    RepositoryPool* pool_;
+    std::unique_ptr<Repository> repo_;
+  };
+
+  /**
+   Open the repository at @param path. The path must be the repository
+   itself, either a bare repository or the .git folder. Throws an
+   exception if it isn't a repository.
+
+   @param maxIdle the maximum number of handles kept in the pool when
+          they are returned.
+  */
+  explicit RepositoryPool(const std::string& path, size_t maxIdle = 16);
+
+  ~RepositoryPool();
+
+  RepositoryPool(const RepositoryPool&) = delete;
+  RepositoryPool& operator=(const RepositoryPool&) = delete;
+
+  // Take a handle from the pool, or open a new one if none is left.
+  // Throws an exception if the repository can't be opened.
+  Handle checkout();
+
+  // Number of handles in the pool.
+  size_t size();
+
+ private:
+  const std::string path_;
+  const size_t maxIdle_;
+
+  // The object database shared by the handles.
+  git_odb* odb_;
+
+  // libgit2 records the last repository given an object database as its
+  // owner, and clears it when that repository is freed. This handle is
+  // never checked out, and takes the ownership back whenever another
+  // handle is given the database or freed, under mutex_.
+  std::unique_ptr<Repository> owner_;
+
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<Repository>> idle_;
+
+  std::unique_ptr<Repository> open();
+  void checkin(std::unique_ptr<Repository> repo);
+};
+
+} // libgit2pp
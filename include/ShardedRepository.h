@@ -0,0 +1,119 @@
+#pragma once
+
+#include "Wrapper.h"
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace libgit2pp {
+
+class ThreadPool;
+
+/**
+ Pick the shard of @param path among @param shards shards. It must give
+ the same shard for a path every time the repository is opened.
+*/
+using ShardRouter =
+    std::function<size_t(const std::string& path, size_t shards)>;
+
+// Route paths by a hash of their top-level directory, so that each
+// top-level directory lives in one shard.
+size_t routeByTopDirectory(const std::string& path, size_t shards);
+
+/**
+ A repository split into shards, each of them a bare repository with its
+ own HEAD, so that commits to different shards don't serialize on one
+ reference.
+
+ The shards are in "shard-N" folders next to "manifest", a bare
+ repository whose commits tie the shard tips together. The tree of each
+ manifest commit has a gitlink "shard-N" to the tip of each shard, and
+ its history is the history of the sharded repository.
+
+ A ShardedRepository may be used by one thread at a time.
+*/
+class ShardedRepository {
+ public:
+  /**
+   Open the sharded repository in the folder @param path, or create it
+   with @param shards shards. @param router picks the shard of each path.
+   Throws an exception if the repositories can't be opened, or if the
+   repository has another number of shards.
+
+   @param threads the number of shards committed at once.
+  */
+  ShardedRepository(
+      const std::string& path,
+      size_t shards,
+      ShardRouter router = routeByTopDirectory,
+      size_t threads = 4);
+
+  ~ShardedRepository();
+
+  ShardedRepository(const ShardedRepository&) = delete;
+  ShardedRepository& operator=(const ShardedRepository&) = delete;
+
+  /**
+   Commit files to their shards in parallel, then commit the manifest on
+   top of HEAD of the manifest repository. Every changed shard gets a
+   commit with the same author and message.
+
+   The tips of the shards are recorded first, and the manifest points to
+   the new commits and the recorded tips of unchanged shards. If a shard
+   or the manifest fails to commit, the shards that were committed are
+   moved back to their recorded tips, or lose their branch if they had
+   none, and the manifest is left unchanged.
+   If no shard tip moves, no manifest commit is written.
+
+   @param additions a map from paths to the contents of added or
+          modified files.
+   @param deletions paths of deleted files.
+   @returns the object ID of the manifest commit, which is HEAD of the
+            manifest if no shard moved, or an empty string on failure or
+            if there is no manifest commit yet.
+  */
+  std::string commit(
+      const std::string& authorName,
+      const std::string& authorEmail,
+      const std::string& message,
+      const std::unordered_map<std::string, std::string>& additions,
+      const std::unordered_set<std::string>& deletions);
+
+  size_t size() const { return shards_.size(); }
+
+  // Get the shard @param path goes to.
+  size_t shardOf(const std::string& path) const;
+
+  Repository& shard(size_t i) { return *shards_[i]; }
+
+  Repository& manifest() { return *manifest_; }
+
+ private:
+  const ShardRouter router_;
+  std::unique_ptr<Repository> manifest_;
+  std::vector<std::unique_ptr<Repository>> shards_;
+  std::unique_ptr<ThreadPool> pool_;
+
+  // Write a manifest commit pointing to @param tips, the tip of each
+  // shard, or nullptr for shards without a commit.
+  bool commitManifest(
+      git_oid* id,
+      const std::vector<const git_oid*>& tips,
+      const std::string& authorName,
+      const std::string& authorEmail,
+      const std::string& message);
+
+  // Move the shards committed as @param ids back to @param tips, or
+  // delete their branch if @param hasTips says they had none.
+  void rollBack(
+      const std::vector<std::string>& ids,
+      const std::vector<git_oid>& tips,
+      const std::vector<bool>& hasTips);
+};
+
+} // libgit2pp
@@ -1,10 +1,13 @@
 #pragma once
 
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace libgit2pp {
 
+class Repository;
+
 // Recreate directory trees at @param root.
 void setupRoot(const std::string& root);
 
@@ -16,4 +19,18 @@ void writeToFile(const std::string& path, const std::string& data);
 // The input path should not have leading '/'.
 std::vector<std::string> splitFilePath(const std::string& path);
 
+// Commit @param files, a map from paths to contents, on top of HEAD of
+// @param r. Returns the ID of the commit, and throws if it fails.
+std::string commitFiles(
+    Repository* r,
+    const std::unordered_map<std::string, std::string>& files);
+
+// The ID of the blob at @param path in the tree of HEAD of @param r, or an
+// empty string if there is no such file or no HEAD.
+std::string blobAt(Repository* r, const std::string& path);
+
+// The contents of the file at @param path in the tree of HEAD of @param r.
+// Throws if the file can't be read.
+std::string readHeadFile(Repository* r, const std::string& path);
+
 }
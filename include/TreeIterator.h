@@ -0,0 +1,110 @@
+#pragma once
+
+#include "Wrapper.h"
+
+#include <cstdint>
+#include <experimental/string_view>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace libgit2pp {
+
+// An entry visited by a TreeIterator.
+struct TreeEntry {
+  // The path of the entry from the tree the walk started at. It is only
+  // valid until the iterator moves.
+  std::experimental::string_view path;
+  const git_tree_entry* entry;
+  // 0 for the entries of the tree the walk started at.
+  size_t depth;
+};
+
+/**
+ Walk depth-first over the entries of a tree and of its subtrees. A tree
+ is visited before its entries, which come in the order of the tree.
+
+ Subtrees are only read when the walk goes into them, and paths are built
+ in one buffer, so the walk allocates per tree rather than per entry.
+ The iterator only moves forward, and can't be copied. The default one
+ is the end of every walk:
+
+   unique_ptr<git_tree> tree(r.getCommitTree(""));
+   for (auto e : TreeIterator(r.get(), tree.get())) {
+     ...
+   }
+*/
+class TreeIterator {
+ public:
+  typedef std::input_iterator_tag iterator_category;
+  typedef TreeEntry value_type;
+  typedef std::ptrdiff_t difference_type;
+  typedef const TreeEntry* pointer;
+  typedef TreeEntry reference;
+
+  TreeIterator() = default;
+
+  /**
+   Start walking @param tree of @param repo. Throws an exception if a
+   tree can't be read.
+
+   @param prefix the path of a folder in the tree to only walk that
+          folder, with its path in front of the paths of entries. Nothing
+          is walked if it isn't a folder.
+   @param maxDepth the depth of the deepest entries visited. 0 doesn't go
+          into subtrees.
+  */
+  TreeIterator(
+      git_repository* repo,
+      const git_tree* tree,
+      const std::string& prefix = std::string(),
+      size_t maxDepth = SIZE_MAX);
+
+  TreeIterator(TreeIterator&&) = default;
+  TreeIterator& operator=(TreeIterator&&) = default;
+
+  bool done() const { return stack_.empty(); }
+
+  TreeEntry operator*() const;
+
+  TreeIterator& operator++() {
+    advance(true);
+    return *this;
+  }
+
+  // Move to the next entry without going into the current one if it is
+  // a tree.
+  void skip() { advance(false); }
+
+  // Only tells whether the iterators are both done or not.
+  bool operator==(const TreeIterator& b) const { return done() == b.done(); }
+  bool operator!=(const TreeIterator& b) const { return done() != b.done(); }
+
+  // For range-based for loops, which walk the iterator itself.
+  TreeIterator begin() { return std::move(*this); }
+  TreeIterator end() const { return TreeIterator(); }
+
+ private:
+  // A tree being walked, and the entry visited in it.
+  struct Level {
+    std::unique_ptr<git_tree> tree;
+    size_t index;
+    size_t count;
+    // The size of the path of the tree, with its trailing '/'.
+    size_t pathSize;
+  };
+
+  git_repository* repo_ = nullptr;
+  size_t maxDepth_ = 0;
+  std::vector<Level> stack_;
+  std::string path_;
+
+  // Go to the first entry of @param tree, or to the next entry if it is
+  // empty.
+  bool push(git_tree* tree);
+  void advance(bool descend);
+  void load();
+};
+
+} // libgit2pp
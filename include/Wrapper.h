@@ -1,13 +1,27 @@
 #pragma once
 
 #include "git2.h"
+#include <chrono>
+#include <experimental/string_view>
+#include <functional>
 #include <string>
+#include <istream>
+#include <map>
 #include <memory>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
+#include <vector>
 
 namespace libgit2pp {
 
+class BlobHandle;
+class HistoryIndex;
+class MaintenanceScheduler;
+class OidSet;
+class ThreadPool;
+class TreeCache;
+
 // A wrapper class to initiating libgit2 library.
 class Git2 {
  public:
@@ -20,6 +34,71 @@ class Git2 {
   }
 };
 
+// Statistics of a commit created by Repository::commit.
+struct CommitStats {
+  // Blobs written to the object database.
+  size_t blobsWritten = 0;
+  // Blobs that were not written, as the object database has them already.
+  size_t blobsDeduplicated = 0;
+  // Trees written to the object database.
+  size_t treesWritten = 0;
+};
+
+// A path changed between two trees, see Repository::diffTrees().
+struct TreeChange {
+  enum Type { Added, Modified, Deleted };
+  Type type;
+  std::string path;
+  // The object IDs and modes on each side. They are zero on the side that
+  // has no such path.
+  git_oid oldId;
+  git_oid newId;
+  git_filemode_t oldMode;
+  git_filemode_t newMode;
+};
+
+/**
+ The zlib levels of the loose objects written by a repository, see
+ Repository::setCompressionPolicy(). Levels go from 0, which stores the
+ contents, to 9. Negative levels mean 1, the level libgit2 uses.
+*/
+struct CompressionPolicy {
+  int commitLevel = 1;
+  int treeLevel = 1;
+  // Blobs of up to smallBlobSize bytes, typically small files that are
+  // rewritten often.
+  size_t smallBlobSize = 4096;
+  int smallBlobLevel = 1;
+  int blobLevel = 1;
+  // Blobs whose sampled entropy reaches this many bits per byte, such as
+  // compressed files, are stored.
+  double storeEntropy = 7.5;
+};
+
+/**
+ How writes of a repository reach the disk, see Repository::setDurability().
+
+ None leaves it to the operating system, and a crash may lose recent
+ commits. Group syncs the files once per commit, or once per batch when
+ commits are batched, before and after the reference is written. Strict
+ syncs every object and reference file as it is written.
+
+ In a batch, references only move once the pack of the batch is written
+ and, with Group, synced. References kept in memory, see
+ Repository::useMemoryRefdb(), get the updates at that point too, so they
+ can't be written to files before the objects they point to.
+*/
+enum class Durability { None, Group, Strict };
+
+// Whether libgit2 syncs every file the process writes, which it does while
+// any repository is Strict.
+bool syncsAllWrites();
+
+// The reflog message git writes for a commit: the first line of
+// @param message, after "commit (initial): " if @param initial, the commit
+// being the first of its reference, or "commit: ".
+std::string commitLogMessage(const std::string& message, bool initial);
+
 // A wrapper class for git_repository.
 class Repository {
  public:
@@ -88,6 +167,64 @@ class Repository {
       const std::unordered_map<std::string, std::string>& additions,
       const std::unordered_set<std::string> deletions);
 
+  /**
+   Create new commit in the repository on top of a given parent.
+
+   @param id If the method returns true, this is the object ID of the
+          new commit.
+   @param parent the object ID of the parent commit, or nullptr to
+          create a root commit. The tree of the new commit is the
+          parent's tree with the changes applied.
+   @param updateRef If not empty, name of the reference that will be
+          updated to point to this commit, see commit(). If the
+          reference exists, @param parent must be its tip.
+   @param authorName
+   @param authorEmail
+   @param message Full message for this commit
+   @param additions maps relative file paths to their corresponding
+          contents.
+   @param deletions a list of relative paths to be deleted in the commit.
+  */
+  bool createCommit(
+      git_oid* id,
+      const git_oid* parent,
+      const std::string& updateRef,
+      const std::string& authorName,
+      const std::string& authorEmail,
+      const std::string& message,
+      const std::unordered_map<std::string, std::string>& additions,
+      const std::unordered_set<std::string>& deletions);
+
+  /**
+   Create new commit on top of a known parent, and move a reference to it
+   only if the reference still points to that parent.
+
+   If another writer moved the reference in the meantime, and none of the
+   paths changed by this commit was changed between @param parent and
+   the new tip, the changes are applied again on top of the new tip and
+   the update is retried. Otherwise the commit fails.
+
+   @param parent the hex SHA of the commit the changes are based on, or
+          an empty string if the reference doesn't exist yet.
+   @param updateRef name of the reference to update, e.g. "HEAD".
+   @param authorName
+   @param authorEmail
+   @param message Full message for this commit
+   @param additions maps relative file paths to their corresponding
+          contents.
+   @param deletions a list of relative paths to be deleted in the commit.
+   @returns the hex SHA of the new commit, or an empty string if the
+            commit fails or conflicts with the new tip.
+  */
+  std::string commitMatching(
+      const std::string& parent,
+      const std::string& updateRef,
+      const std::string& authorName,
+      const std::string& authorEmail,
+      const std::string& message,
+      const std::unordered_map<std::string, std::string>& additions,
+      const std::unordered_set<std::string>& deletions);
+
   /*
    Create a new tree in object database.
 
@@ -161,6 +298,50 @@ class Repository {
   */
   bool createBlobFromDisk(const std::string& path, git_oid* id);
 
+  /**
+   Write an in-memory buffer to the Object Database as a loose blob,
+   without going through the filesystem.
+
+   @param data contents of the blob
+   @param id return the id of the written blob
+   @return true if there is no error.
+  */
+  bool createBlobFromBuffer(const std::string& data, git_oid* id);
+
+  /**
+   Open a stream to write a blob of a known size in chunks.
+
+   Contents are hashed and compressed as they arrive, so the full blob
+   never has to be held in memory. Use the BlobWriter class to manage
+   the returned stream.
+
+   @param size exact number of bytes that will be written to the stream
+   @return nullptr if the stream cannot be opened.
+  */
+  git_odb_stream* createBlobStream(uint64_t size);
+
+  /**
+   Read a blob from an open file descriptor, in chunks, until the end of
+   the file and write it to the Object Database.
+
+   @param fd a readable file descriptor of a regular file
+   @param id return the id of the written blob
+   @return true if there is no error.
+  */
+  bool createBlobFromFd(int fd, git_oid* id);
+
+  /**
+   Read a blob from an input stream, in chunks, until the end of the
+   stream and write it to the Object Database. If the stream is not
+   seekable its size cannot be known upfront, and the contents are
+   spooled to a temporary file by libgit2 instead.
+
+   @param in the input stream
+   @param id return the id of the written blob
+   @return true if there is no error.
+  */
+  bool createBlobFromStream(std::istream& in, git_oid* id);
+
   /**
    Create new commit in the repository from a list of `git_object` pointers
 
@@ -194,9 +375,39 @@ class Repository {
       size_t parentCount,
       const git_commit *parents[]);
 
+  /**
+   Move the reference @param refName to the commit @param id, only if it
+   still points to @param old, or doesn't exist yet if @param old is
+   nullptr, like git_reference_create_matching(). This publishes commits
+   created by createCommit() without a reference, @param id being the
+   last of them. Symbolic references are resolved first.
+
+   During a batch, the update is kept in memory, and the reference is
+   moved by flushBatch() once the objects are written.
+
+   @param logMessage the message of the reflog entry.
+   @returns 0, or the libgit2 error, such as GIT_EMODIFIED if the
+            reference was moved by someone else.
+  */
+  int updateReference(
+      const std::string& refName,
+      const git_oid* id,
+      const git_oid* old,
+      const std::string& logMessage);
+
+  // Get the commit @param refName points to into @param out, including
+  // updates kept until the batch is written. Returns false if there is no
+  // such reference, and throws if it can't be resolved to a commit.
+  bool readReference(const std::string& refName, git_oid* out);
+
   // Get git_reference object for HEAD.
   git_reference* getHead();
 
+  // Resolve a symbolic reference, such as HEAD, to the name of the direct
+  // reference it points to, which may not exist yet. Other names are
+  // returned as is.
+  std::string resolveReferenceName(const std::string& name);
+
   // Get object database of this repository.
   git_odb* getOdb();
 
@@ -208,10 +419,237 @@ class Repository {
   */
   git_commit* getCommit(const git_oid* id);
 
+  /**
+   Find the files and submodules changed between two commits. Only
+   trees are read: subtrees with the same object ID on both sides are
+   skipped, and the entries of others are merged in the order of git
+   trees. A path that changes between a file and a folder is deleted on
+   one side and added on the other.
+
+   @param a, b the hex representations of the commits. If one is empty,
+          HEAD is used.
+   @param changes the changes from @param a to @param b are added to it.
+   @returns false if a tree can't be read.
+  */
+  bool diffTrees(
+      const std::string& a,
+      const std::string& b,
+      std::vector<TreeChange>* changes);
+
+  /**
+   Walk the history from a commit, newest first, and visit the commits
+   that change the file or folder at @param path. A commit changes it if
+   the object at the path differs from the one in each of its parents.
+   Only the trees along the path are read, from the root down to the
+   first one that is the same in both commits. Commits are read as the
+   walk goes, and those of the same second come before their parents.
+
+   @param commit the hex representation of a commit. If it is empty, the
+          walk starts from HEAD.
+   @param path the path of a file or a folder, or empty for any change.
+   @param firstParent whether to only follow the first parent of merges.
+   @param limit the walk stops after visiting this many commits.
+   @param visit called with each commit, and returns false to stop the
+          walk.
+   @returns false if a commit or a tree can't be read.
+  */
+  bool walkHistory(
+      const std::string& commit,
+      const std::string& path,
+      bool firstParent,
+      size_t limit,
+      const std::function<bool(const git_commit*)>& visit);
+
+  /**
+   Keep an index of the commits that change each path, in the "history"
+   folder of the repository, see HistoryIndex.h. Commits created by this
+   handle are added to it, with the files and folders they change from
+   their first parent, and historyOf() reads them back without walking
+   the history.
+
+   A commit is added once a reference is moved to it by this handle, see
+   updateReference(), so commits that never land on a branch are left
+   out. Commits made by other handles, or by git, are not added; use
+   rebuildHistoryIndex() to index existing history. Only one handle may
+   use the index of a repository at a time. Throws an exception if the
+   index can't be opened.
+  */
+  void useHistoryIndex();
+
+  /**
+   Replace the history index with the commits reachable from @param
+   commit, the hex representation of a commit or empty for HEAD. Each
+   commit is indexed with the paths it changes from its first parent,
+   like the commits of this handle. The index is opened if needed.
+
+   @returns false if a commit or a tree can't be read, or the index
+            can't be written.
+  */
+  bool rebuildHistoryIndex(const std::string& commit);
+
+  /**
+   Visit the indexed commits that change the file or folder at @param
+   path, most recently indexed first, see useHistoryIndex(). Unlike
+   walkHistory(), this follows no branch: commits of every reference
+   this handle moved are listed.
+
+   @param path the path of a file or a folder, or empty for any change.
+   @param limit the lookup stops after visiting this many commits.
+   @param visit called with each commit ID, and returns false to stop.
+   @returns false if there is no index or it can't be read.
+  */
+  bool historyOf(
+      const std::string& path,
+      size_t limit,
+      const std::function<bool(const git_oid*)>& visit);
+
+  // Look up the tree of @param commit, the hex representation of a
+  // commit or empty for HEAD. Returns nullptr if there is none. The
+  // caller needs to release it later.
+  git_tree* getCommitTree(const std::string& commit);
+
   // Get the information for a particular remote
   // @param name the remote's name
   git_remote* getRemote(const std::string& name);
 
+  /**
+   Read the file at @param path in a commit without copying its contents.
+
+   @param commit the hex representation of a commit. If it is empty, the
+          file is read from HEAD.
+   @returns the blob of the file, or an empty handle if the commit or the
+            file can't be found, or if the path isn't a file.
+  */
+  BlobHandle readFile(const std::string& commit, const std::string& path);
+
+  /**
+   Read the files at @param paths in a commit, walking the tree of the
+   commit once for all of them. Files of the same folder share the
+   lookups of its trees.
+
+   With setParallelism(), large batches of blobs are read by the worker
+   handles in parallel. Their blobs must be released before the workers
+   are replaced by another call to setParallelism().
+
+   @param commit the hex representation of a commit. If it is empty, the
+          files are read from HEAD.
+   @returns the blob of each path, in the same order, or an empty handle
+            for paths that aren't files of the commit.
+  */
+  std::vector<BlobHandle> readFiles(
+      const std::string& commit,
+      const std::vector<std::string>& paths);
+
+  /**
+   Set the maximum number of trees that are kept in memory between
+   consecutive commits. Trees written by a commit are reused by the next
+   one instead of being read back from the object database. 0 disables
+   the cache.
+  */
+  void setTreeCacheSize(size_t size);
+
+  /**
+   Create the blobs and build the trees of commits on @param threads
+   threads. Each thread has its own repository handle and tree cache.
+
+   Blobs of a commit are hashed, compressed and written concurrently.
+   For large commits, sub-trees of the root with changes are spread over
+   the threads too, and joined at the root. The objects written are the
+   same as when created serially. 0 or 1 turns parallelism off.
+  */
+  void setParallelism(size_t threads);
+
+  /**
+   Keep the objects written by commits in memory, and write them to the
+   object database as a single packfile once more than @param maxBytes
+   of file contents were committed, or @param maxAge elapsed since the
+   first commit of the batch. The thresholds are checked after each
+   commit; flushBatch() writes the pack on demand.
+
+   References are moved by the flush, once the objects are written, so
+   they never point to objects that are only in memory. Until then,
+   commits of this handle build on the updates kept in memory, see
+   readReference(), but other repository handles don't see the new
+   commits, and they are lost if the process exits. Blobs and trees are
+   created serially while batching. Throws an exception if the in-memory object
+   database can't be set up.
+  */
+  void beginBatch(
+      size_t maxBytes = 64 * 1024 * 1024,
+      std::chrono::milliseconds maxAge = std::chrono::seconds(30));
+
+  // Write the objects kept in memory as a packfile, then move the
+  // references of the batch. Returns true if there is nothing to write,
+  // or the pack is written and the references are moved.
+  bool flushBatch();
+
+  // Flush the batch, and write objects directly to the object database
+  // again. Returns false if the last flush fails.
+  bool endBatch();
+
+  /**
+   Write new objects to an append-only log in the "log" folder of the
+   object database instead of loose files, see LogBackend.h. Segments of
+   the log are sealed at @param maxSegmentSize bytes. Objects already in
+   the repository are still read from loose files and packs.
+
+   Objects in the log are only found by repository handles that use the
+   log too, and git itself doesn't read them. Only one handle in one
+   process may use the log of a repository at a time; the worker handles
+   of setParallelism() share it. Throws an exception if the log can't be
+   opened.
+  */
+  void useLogBackend(size_t maxSegmentSize = 256 * 1024 * 1024);
+
+  /**
+   Write loose objects with the zlib levels chosen by @param policy
+   instead of the default level. Objects written to a batch or to the
+   log are not affected. Throws an exception if the object database
+   can't be set up.
+  */
+  void setCompressionPolicy(const CompressionPolicy& policy);
+
+  /**
+   Keep references in memory, see MemoryRefdb.h. Updates are checked,
+   appended to a journal and applied in memory, and the references are
+   written to files after @param batchSize updates, when
+   flushRefs() is called, or when the repository is closed. Each flush
+   adds one reflog entry per update. Updates left in the journal by a
+   crash are written when the next handle uses it.
+
+   Other repository handles, and git itself, only see the references
+   written so far. Only one handle may keep the references of a
+   repository in memory at a time. Throws an exception if the journal
+   can't be opened.
+  */
+  void useMemoryRefdb(size_t batchSize = 64);
+
+  // Write the references kept in memory. Returns true if there is nothing
+  // to write or the references are written.
+  bool flushRefs();
+
+  /**
+   Set how writes reach the disk, see Durability. Group syncs the whole
+   file system of the repository with syncfs(), and orders the sync of
+   the objects before the reference update that makes them reachable.
+
+   libgit2 only syncs files for all repositories of the process, so
+   while any repository is Strict, the writes of the others are synced
+   too. Throws an exception if the object database can't be set up
+   again.
+  */
+  void setDurability(Durability durability);
+
+  // Notify @param scheduler of the loose objects written by commits, or
+  // stop notifying if it is nullptr. The scheduler must outlive this
+  // repository or be detached first.
+  void setMaintenanceScheduler(MaintenanceScheduler* scheduler) {
+    maintenance_ = scheduler;
+  }
+
+  // Get the statistics of the last commit created from file contents.
+  const CommitStats& getLastCommitStats() const { return stats_; }
+
   git_repository* get() { return repo_; }
 
   // Returns git_repository pointer. The caller needs to
@@ -221,14 +659,169 @@ class Repository {
  private:
   git_repository* repo_;
 
+  // Trees written by recent commits.
+  std::unique_ptr<TreeCache> treeCache_;
+
+  // Threads and their repository handles for building trees in parallel.
+  std::unique_ptr<ThreadPool> pool_;
+  std::vector<std::unique_ptr<Repository>> workers_;
+
+  // Blobs of commits that landed on a reference, which are known to be in
+  // the object database.
+  std::unique_ptr<OidSet> knownBlobs_;
+
+  CommitStats stats_;
+
+  // The in-memory backend receiving new objects during a batch, owned by
+  // the object database of the repository.
+  git_odb_backend* mempack_;
+  size_t batchMaxBytes_;
+  std::chrono::milliseconds batchMaxAge_;
+  size_t batchBytes_;
+  std::chrono::steady_clock::time_point batchStart_;
+
+  MaintenanceScheduler* maintenance_;
+
+  // Maximum size of the log segments, or 0 if the log is not used.
+  size_t logSegmentSize_;
+
+  // How loose objects are compressed, or nullptr for the default.
+  std::unique_ptr<CompressionPolicy> compression_;
+
+  // The in-memory reference backend, owned by the reference database of
+  // the repository, or nullptr.
+  git_refdb_backend* refdb_;
+
+  Durability durability_;
+
+  // A reference update kept until the objects of a batch are written.
+  struct PendingRef {
+    git_oid old = git_oid();
+    bool hasOld = false;
+    // The last commit of steps.
+    git_oid id = git_oid();
+    // The commits the reference moves to in turn, each with the message
+    // of its reflog entry.
+    std::vector<std::pair<git_oid, std::string>> steps;
+  };
+
+  // Updates of the current batch, by reference name.
+  std::unordered_map<std::string, PendingRef> pendingRefs_;
+
+  // Commits that changed each path, or nullptr.
+  std::unique_ptr<HistoryIndex> history_;
+
+  // A commit created by this handle that no reference points to yet.
+  // Only commits that have blobs to remember, or that the history index
+  // needs, are kept.
+  struct Unlanded {
+    // When it was created, see unlandedOrder_.
+    uint64_t seq = 0;
+    git_oid parent = git_oid();
+    git_oid parentTree = git_oid();
+    bool hasParent = false;
+    git_oid tree = git_oid();
+    // The blobs of the files it adds or changes.
+    std::vector<git_oid> blobs;
+  };
+
+  // By the raw bytes of the commit ID.
+  std::unordered_map<std::string, Unlanded> unlanded_;
+  // The keys of unlanded_ in the order the commits were created.
+  std::map<uint64_t, std::string> unlandedOrder_;
+  uint64_t unlandedSeq_ = 0;
+
+  // Add the commit @param id to unlanded_, dropping the oldest commits if
+  // there are too many.
+  Unlanded& addUnlanded(const git_oid* id);
+
+  // Drop the commits created before @param seq from unlanded_, except
+  // those of references the batch still has to move. They were left
+  // behind by the references that moved since.
+  void dropUnlanded(uint64_t seq);
+
+  // Remove the commits created by this handle from @param tip back to
+  // @param old from unlanded_, and return them oldest first.
+  std::vector<std::pair<git_oid, Unlanded>> takeUnlanded(
+      const git_oid* tip,
+      const git_oid* old);
+
+  // Add the commits from @param tip back to @param old, that a reference
+  // was just moved over, to the history index, and remember their blobs
+  // as known.
+  void land(const git_oid* tip, const git_oid* old);
+
+  // Add the commit @param id to the history index with the paths that
+  // change from @param parentTree to @param tree. nullptr is an empty
+  // tree. Returns false if a tree can't be read or the index written.
+  bool indexCommit(
+      const git_oid* id,
+      const git_oid* parentTree,
+      const git_oid* tree);
+
+  // Sync the file system of the repository. Returns true on success.
+  bool syncGroup();
+
+  // Give the repository a new object database, with an in-memory
+  // backend if @param inMemory is true.
+  void resetOdb(bool inMemory);
+
+  // @param source the object ID of the original tree, or nullptr to
+  // start from an empty tree.
   bool createTreeUsingGitTree(
       git_oid* id,
-      std::unique_ptr<git_tree> tree,
+      const git_oid* source,
       const std::unordered_map<std::string, git_oid*>& addedFiles,
       const std::unordered_set<std::string>& deletedFiles);
 
   // Get last commit. If there is no commit yet, returns nullptr.
   git_commit* getHeadCommit();
+
+  // A commit and its tree.
+  struct Tip {
+    git_oid commit = git_oid();
+    git_oid tree = git_oid();
+  };
+
+  // What references pointed to when this repository last read or moved
+  // them, by reference name.
+  std::unordered_map<std::string, Tip> tips_;
+
+  // The last commit created by this repository.
+  Tip lastCommit_;
+
+  /**
+   Get the commit @param refName points to into @param out. The cached
+   tip is checked against the reference, and the commit is only read if
+   the reference was moved by someone else. Returns false if there is no
+   commit yet, and throws if the reference can't be resolved to a commit.
+  */
+  bool resolveTip(const std::string& refName, git_oid* out);
+
+  // Get the tree of the commit @param commit into @param out. Returns
+  // false if the commit can't be read.
+  bool getTreeOf(const git_oid* commit, git_oid* out);
+
+  // Get the object ID of @param commit, the hex representation of a
+  // commit or empty for HEAD, into @param out. Returns false if there is
+  // none.
+  bool resolveCommit(const std::string& commit, git_oid* out);
+
+  // Write blobs with @param contents to the object database, storing
+  // their object IDs in the array @param ids. Throws on failure.
+  void createBlobs(
+      const std::vector<const std::string*>& contents,
+      git_oid* ids);
+
+  // Write a blob through the repository handle @param handle, unless the
+  // object database has it already, or @param claim, if set, returns false
+  // as another worker writes it. Returns true if the blob is written.
+  // Throws on failure.
+  bool createBlobIfMissing(
+      Repository* handle,
+      const std::string& data,
+      git_oid* id,
+      const std::function<bool(const git_oid*)>& claim = nullptr);
 };
 
 // A wrapper class for git_tree_builder.
@@ -308,6 +901,46 @@ class TreeBuilder {
   git_treebuilder* b_;
 };
 
+// A wrapper class for git_odb_stream opened by createBlobStream.
+class BlobWriter {
+ public:
+  // Construct a wrapper from the actual stream.
+  explicit BlobWriter(git_odb_stream* stream) : s_(stream) {
+  }
+
+  ~BlobWriter() {
+    if (s_) {
+      git_odb_stream_free(s_);
+    }
+  }
+
+  /**
+   Write a chunk of the blob.
+
+   @param data the chunk to write
+   @param len size of the chunk
+   @return false if there is an error, e.g. more bytes are written than
+           the size the stream was opened with.
+  */
+  bool write(const char* data, size_t len) {
+    return (0 == git_odb_stream_write(s_, data, len));
+  }
+
+  /**
+   Finish writing the blob. All the bytes the stream was opened with
+   must have been written.
+
+   @param id Pointer to store the OID of the newly written blob
+   @return true if there is no error.
+  */
+  bool finalize(git_oid* id) {
+    return (0 == git_odb_stream_finalize_write(id, s_));
+  }
+
+ private:
+  git_odb_stream* s_;
+};
+
 } // libgit2pp
 
 namespace std {
@@ -336,6 +969,14 @@ template <> struct default_delete<git_odb> {
   }
 };
 
+template <> struct default_delete<git_odb_stream> {
+  void operator()(git_odb_stream* stream) const {
+    if (stream) {
+      git_odb_stream_free(stream);
+    }
+  }
+};
+
 template <> struct default_delete<git_commit> {
   void operator()(git_commit* commit) const {
     if (commit) {
@@ -352,6 +993,22 @@ template <> struct default_delete<git_remote> {
   }
 };
 
+template <> struct default_delete<git_tree_entry> {
+  void operator()(git_tree_entry* entry) const {
+    if (entry) {
+      git_tree_entry_free(entry);
+    }
+  }
+};
+
+template <> struct default_delete<git_packbuilder> {
+  void operator()(git_packbuilder* pb) const {
+    if (pb) {
+      git_packbuilder_free(pb);
+    }
+  }
+};
+
 template <> struct default_delete<git_treebuilder> {
   void operator()(git_treebuilder* b) const {
     if (b) {
@@ -360,4 +1017,70 @@ template <> struct default_delete<git_treebuilder> {
   }
 };
 
+template <> struct default_delete<git_refdb> {
+  void operator()(git_refdb* refdb) const {
+    if (refdb) {
+      git_refdb_free(refdb);
+    }
+  }
+};
+
+template <> struct default_delete<git_signature> {
+  void operator()(git_signature* sig) const {
+    if (sig) {
+      git_signature_free(sig);
+    }
+  }
+};
+
+template <> struct default_delete<git_revwalk> {
+  void operator()(git_revwalk* walk) const {
+    if (walk) {
+      git_revwalk_free(walk);
+    }
+  }
+};
+
+template <> struct default_delete<git_blob> {
+  void operator()(git_blob* blob) const {
+    if (blob) {
+      git_blob_free(blob);
+    }
+  }
+};
+
 } // std
+
+namespace libgit2pp {
+
+/**
+ A blob read by Repository::readFile(). Its contents are read in place
+ from the blob, and stay valid as long as the handle does.
+*/
+class BlobHandle {
+ public:
+  BlobHandle() = default;
+
+  // Take the ownership of @param blob.
+  explicit BlobHandle(git_blob* blob) : blob_(blob) {}
+
+  explicit operator bool() const { return blob_ != nullptr; }
+
+  std::experimental::string_view contents() const {
+    if (!blob_) {
+      return std::experimental::string_view();
+    }
+    return std::experimental::string_view(
+        static_cast<const char*>(git_blob_rawcontent(blob_.get())),
+        git_blob_rawsize(blob_.get()));
+  }
+
+  const git_oid* id() const { return git_blob_id(blob_.get()); }
+
+  git_blob* get() const { return blob_.get(); }
+
+ private:
+  std::unique_ptr<git_blob> blob_;
+};
+
+} // libgit2pp
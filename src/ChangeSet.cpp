@@ -0,0 +1,112 @@
+#include "ChangeSet.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace libgit2pp {
+
+ChangeSet::ChangeSet() : fileCount_(0) {
+}
+
+ChangeSet::~ChangeSet() {
+}
+
+bool ChangeSet::build(
+    const unordered_map<string, git_oid*>& addedFiles,
+    const unordered_set<string>& deletedFiles) {
+  changes_.clear();
+  changes_.reserve(addedFiles.size() + deletedFiles.size());
+
+  // Each component of a path needs at most one node, plus the root.
+  size_t maxNodes = 1;
+  for (auto& p : addedFiles) {
+    changes_.push_back(Change{p.first, p.second});
+    maxNodes += count(p.first.begin(), p.first.end(), '/') + 1;
+  }
+  for (auto& s : deletedFiles) {
+    changes_.push_back(Change{s, nullptr});
+    maxNodes += count(s.begin(), s.end(), '/') + 1;
+  }
+
+  // Paths under the same directory become adjacent once sorted. For the
+  // same path, the addition goes first.
+  sort(changes_.begin(), changes_.end(),
+       [](const Change& a, const Change& b) {
+         int c = a.path.compare(b.path);
+         return c < 0 || (c == 0 && a.id != nullptr && b.id == nullptr);
+       });
+
+  // The arena is never reallocated, so nodes can point to each other.
+  nodes_.clear();
+  nodes_.reserve(maxNodes);
+  nodes_.push_back(Node{string_view(), nullptr, nullptr, nullptr, nullptr,
+                        false, nullptr});
+  fileCount_ = 0;
+
+  // Directories of the previous path, from the root down, and where the
+  // next component starts after each of them.
+  dirs_.clear();
+  ends_.clear();
+  dirs_.push_back(&nodes_[0]);
+  ends_.push_back(0);
+
+  string_view prev;
+  for (auto& c : changes_) {
+    auto path = c.path;
+    if (path.empty()) {
+      return false;
+    } else if (path == prev) {
+      continue;
+    }
+
+    // Skip the directories shared with the previous path.
+    size_t common = 0;
+    while (common < path.size() && common < prev.size() &&
+           path[common] == prev[common]) {
+      ++common;
+    }
+    while (ends_.back() > common) {
+      dirs_.pop_back();
+      ends_.pop_back();
+    }
+
+    // Create the remaining directories and the file.
+    for (size_t start = ends_.back();;) {
+      auto pos = path.find('/', start);
+      auto name = path.substr(start, pos == string_view::npos
+                                         ? string_view::npos
+                                         : pos - start);
+      if (name.empty()) {
+        return false;
+      }
+      if (pos == string_view::npos) {
+        newNode(dirs_.back(), name, true)->id = c.id;
+        ++fileCount_;
+        break;
+      }
+      dirs_.push_back(newNode(dirs_.back(), name, false));
+      ends_.push_back(pos + 1);
+      start = pos + 1;
+    }
+
+    prev = path;
+  }
+
+  return true;
+}
+
+ChangeSet::Node* ChangeSet::newNode(Node* parent, string_view name, bool isFile) {
+  nodes_.push_back(Node{name, parent, nullptr, nullptr, nullptr,
+                        isFile, nullptr});
+  auto n = &nodes_.back();
+  if (parent->lastChild) {
+    parent->lastChild->nextSibling = n;
+  } else {
+    parent->firstChild = n;
+  }
+  parent->lastChild = n;
+  return n;
+}
+
+} // libgit2pp
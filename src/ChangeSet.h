@@ -0,0 +1,76 @@
+#pragma once
+
+#include "git2.h"
+
+#include <experimental/string_view>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace libgit2pp {
+
+using std::experimental::string_view;
+
+/**
+ A trie of the paths changed by a commit. This class is used by
+ Repository to plan which trees need to be rewritten.
+
+ Path components are views into the path strings handed to the change
+ set, and all nodes live in one arena that is sized upfront, so building
+ the trie does not allocate per path or per prefix. The path strings
+ must outlive the change set.
+*/
+class ChangeSet {
+ public:
+  // Represent a changed file or a directory with changes.
+  struct Node {
+    // Base name of the file or directory.
+    string_view name;
+    Node* parent;
+    // Children in the order of their paths.
+    Node* firstChild;
+    Node* lastChild;
+    Node* nextSibling;
+    // True if the node is a file.
+    bool isFile;
+    // The object ID of a file to add or update, or nullptr if the file
+    // is to be deleted.
+    const git_oid* id;
+  };
+
+  ChangeSet();
+
+  ~ChangeSet();
+
+  /**
+   Build the trie. A path that is both added and deleted is added.
+
+   @returns false if a path is empty or has empty components.
+  */
+  bool build(
+      const std::unordered_map<std::string, git_oid*>& addedFiles,
+      const std::unordered_set<std::string>& deletedFiles);
+
+  // The root directory. It has no children if there is no change.
+  const Node* root() const { return &nodes_[0]; }
+
+  // The number of changed files.
+  size_t fileCount() const { return fileCount_; }
+
+ private:
+  struct Change {
+    string_view path;
+    const git_oid* id;
+  };
+
+  std::vector<Change> changes_;
+  std::vector<Node> nodes_;
+  std::vector<Node*> dirs_;
+  std::vector<size_t> ends_;
+  size_t fileCount_;
+
+  Node* newNode(Node* parent, string_view name, bool isFile);
+};
+
+} // libgit2pp
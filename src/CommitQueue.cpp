@@ -0,0 +1,180 @@
+#include "CommitQueue.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+
+namespace libgit2pp {
+
+// Number of times a batch is rebuilt when the reference is moved by
+// someone else while the batch is committed.
+const int maxBatchAttempts = 3;
+
+// Number of times the reference is updated again while someone else holds
+// its lock, waiting twice as long each time, up to maxLockDelay.
+const int maxLockAttempts = 16;
+const chrono::milliseconds maxLockDelay(64);
+
+CommitQueue::CommitQueue(
+    Repository* repo,
+    const string& updateRef,
+    size_t maxBatchSize)
+  : repo_(repo),
+    updateRef_(updateRef),
+    maxBatchSize_(maxBatchSize > 0 ? maxBatchSize : 1),
+    stop_(false) {
+  thread_ = thread([this] { run(); });
+}
+
+CommitQueue::~CommitQueue() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+}
+
+future<string> CommitQueue::submit(
+    const string& authorName,
+    const string& authorEmail,
+    const string& message,
+    const unordered_map<string, string>& additions,
+    const unordered_set<string>& deletions) {
+  Request req;
+  req.authorName = authorName;
+  req.authorEmail = authorEmail;
+  req.message = message;
+  req.additions = additions;
+  req.deletions = deletions;
+  auto ret = req.result.get_future();
+  {
+    lock_guard<mutex> lock(mutex_);
+    requests_.push_back(std::move(req));
+  }
+  cv_.notify_one();
+  return ret;
+}
+
+void CommitQueue::run() {
+  for (;;) {
+    deque<Request> batch;
+    {
+      unique_lock<mutex> lock(mutex_);
+      cv_.wait(lock, [this] { return stop_ || !requests_.empty(); });
+      if (requests_.empty()) {
+        // Stopping, and nothing is left to commit.
+        return;
+      }
+      while (!requests_.empty() && batch.size() < maxBatchSize_) {
+        batch.push_back(std::move(requests_.front()));
+        requests_.pop_front();
+      }
+    }
+
+    vector<string> ids;
+    bool done = false;
+    for (int i = 0; i < maxBatchAttempts && !done; ++i) {
+      try {
+        done = commitBatch(batch, &ids);
+      } catch (...) {
+        for (auto& req : batch) {
+          req.result.set_exception(current_exception());
+        }
+        batch.clear();
+        break;
+      }
+    }
+    for (size_t i = 0; i < batch.size(); ++i) {
+      batch[i].result.set_value(done ? ids[i] : string());
+    }
+  }
+}
+
+bool CommitQueue::commitBatch(deque<Request>& batch, vector<string>* ids) {
+  ids->assign(batch.size(), string());
+
+  // HEAD may point to a branch that doesn't exist yet.
+  string refName = repo_->resolveReferenceName(updateRef_);
+  git_oid tip;
+  bool hasTip = repo_->readReference(refName, &tip);
+
+  git_oid parent = tip;
+  bool hasParent = hasTip;
+  // Each commit created, with its index in the batch.
+  vector<pair<size_t, git_oid>> created;
+  for (size_t i = 0; i < batch.size(); ++i) {
+    auto& req = batch[i];
+    git_oid id;
+    // A failed commit leaves the chain as it is.
+    if (!repo_->createCommit(
+            &id,
+            hasParent ? &parent : nullptr,
+            string(),
+            req.authorName,
+            req.authorEmail,
+            req.message,
+            req.additions,
+            req.deletions)) {
+      continue;
+    }
+    (*ids)[i].resize(GIT_OID_HEXSZ);
+    git_oid_nfmt(const_cast<char*>((*ids)[i].data()), GIT_OID_HEXSZ, &id);
+    parent = id;
+    hasParent = true;
+    created.emplace_back(i, id);
+  }
+
+  // Move the reference through the chain one commit at a time, so that
+  // each commit gets its own reflog entry, and only if it still points
+  // where the chain starts.
+  for (size_t k = 0; k < created.size(); ++k) {
+    size_t i = created[k].first;
+    const git_oid* old = k > 0 ? &created[k - 1].second
+                               : hasTip ? &tip : nullptr;
+    int ret = updateReference(
+        refName, &created[k].second, old,
+        commitLogMessage(batch[i].message, old == nullptr));
+    if (ret == 0) {
+      continue;
+    }
+    if (ret != GIT_EMODIFIED && ret != GIT_EEXISTS && ret != GIT_ELOCKED) {
+      throw runtime_error("Fails to update " + refName);
+    }
+    cerr << refName << " was moved or locked, committing the batch again"
+         << endl;
+    // The commits the reference already points to are done.
+    size_t landed = k > 0 ? created[k - 1].first + 1 : 0;
+    for (size_t j = 0; j < landed; ++j) {
+      batch.front().result.set_value((*ids)[j]);
+      batch.pop_front();
+    }
+    ids->erase(ids->begin(), ids->begin() + landed);
+    return false;
+  }
+  return true;
+}
+
+int CommitQueue::updateReference(
+    const string& refName,
+    const git_oid* id,
+    const git_oid* old,
+    const string& logMessage) {
+  int ret;
+  auto delay = chrono::milliseconds(1);
+  for (int i = 0; ; ++i) {
+    ret = repo_->updateReference(refName, id, old, logMessage);
+    if (ret != GIT_ELOCKED || i == maxLockAttempts) {
+      return ret;
+    }
+    // Another writer holds the lock of the reference.
+    this_thread::sleep_for(delay);
+    delay = min(delay * 2, maxLockDelay);
+  }
+}
+
+} // libgit2pp
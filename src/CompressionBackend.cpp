@@ -0,0 +1,248 @@
+#include "CompressionBackend.h"
+#include "git2/sys/odb_backend.h"
+
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+using namespace std;
+
+namespace libgit2pp {
+
+namespace {
+
+// Number of zlib levels, from 0 to 9.
+const int levels = 10;
+
+// Number of bytes looked at to estimate the entropy of a blob.
+const size_t entropySampleSize = 4096;
+
+// Streams of objects up to this size are buffered, so that the level is
+// chosen from the contents. Larger objects are streamed to disk.
+const size_t maxBufferedSize = 1024 * 1024;
+
+struct CompressionBackend {
+  git_odb_backend parent;
+  CompressionPolicy policy;
+  std::string objectsDir;
+  bool syncWrites;
+  // Loose backends writing with each level from 1, nullptr if unused.
+  // The loose backend writes no zlib stream at all with level 0.
+  git_odb_backend* loose[levels];
+};
+
+CompressionBackend* backendOf(git_odb_backend* backend) {
+  return reinterpret_cast<CompressionBackend*>(backend);
+}
+
+int levelOf(const CompressionPolicy& policy, git_otype type, size_t size) {
+  switch (type) {
+    case GIT_OBJ_BLOB:
+      return size <= policy.smallBlobSize ? policy.smallBlobLevel
+                                          : policy.blobLevel;
+    case GIT_OBJ_TREE:
+      return policy.treeLevel;
+    default:
+      return policy.commitLevel;
+  }
+}
+
+/**
+ Write a loose object whose contents are stored in a zlib stream without
+ compression. With @param syncWrites, the file and its folder are synced
+ like libgit2 does.
+*/
+int writeStored(
+    const string& objectsDir,
+    bool syncWrites,
+    const git_oid* id,
+    const void* data,
+    size_t size,
+    git_otype type) {
+  char header[64];
+  int headerSize = snprintf(header, sizeof(header), "%s %zu",
+                            git_object_type2string(type), size) + 1;
+  vector<unsigned char> raw(headerSize + size);
+  memcpy(raw.data(), header, headerSize);
+  memcpy(raw.data() + headerSize, data, size);
+  uLongf zsize = compressBound(raw.size());
+  vector<unsigned char> z(zsize);
+  if (Z_OK != compress2(z.data(), &zsize, raw.data(), raw.size(), 0)) {
+    return GIT_ERROR;
+  }
+
+  char hex[GIT_OID_HEXSZ + 1];
+  git_oid_tostr(hex, sizeof(hex), id);
+  string dir = objectsDir + "/" + string(hex, 2);
+  string path = dir + "/" + (hex + 2);
+  mkdir(dir.c_str(), 0755);
+
+  // Write a temporary file, and move it in place once complete.
+  string tmp = dir + "/tmp_obj_XXXXXX";
+  int fd = mkstemp(&tmp[0]);
+  if (fd < 0) {
+    return GIT_ERROR;
+  }
+  bool ok = (ssize_t) zsize == ::write(fd, z.data(), zsize);
+  ok = ok && (!syncWrites || 0 == fsync(fd));
+  ok = (0 == close(fd)) && ok;
+  ok = ok && 0 == chmod(tmp.c_str(), 0444) &&
+      0 == rename(tmp.c_str(), path.c_str());
+  if (!ok) {
+    unlink(tmp.c_str());
+    return GIT_ERROR;
+  }
+  if (syncWrites) {
+    int dirFd = open(dir.c_str(), O_RDONLY);
+    ok = (dirFd >= 0 && 0 == fsync(dirFd));
+    if (dirFd >= 0) {
+      close(dirFd);
+    }
+  }
+  return ok ? 0 : GIT_ERROR;
+}
+
+int compressedWrite(
+    git_odb_backend* backend,
+    const git_oid* id,
+    const void* data,
+    size_t size,
+    git_otype type) {
+  auto b = backendOf(backend);
+  int level = levelOf(b->policy, type, size);
+  // Compressed contents don't get smaller, so they are stored as is.
+  if (type == GIT_OBJ_BLOB && level > 0 &&
+      estimateEntropy(data, size) >= b->policy.storeEntropy) {
+    level = 0;
+  }
+  if (level == 0) {
+    return writeStored(b->objectsDir, b->syncWrites, id, data, size, type);
+  }
+  auto loose = b->loose[level];
+  return loose->write(loose, id, data, size, type);
+}
+
+// A stream keeping the contents in memory until they are written.
+struct BufferedStream {
+  git_odb_stream parent;
+  git_otype type;
+  string data;
+};
+
+int bufferedWrite(git_odb_stream* stream, const char* buffer, size_t len) {
+  reinterpret_cast<BufferedStream*>(stream)->data.append(buffer, len);
+  return 0;
+}
+
+int bufferedFinalizeWrite(git_odb_stream* stream, const git_oid* id) {
+  auto s = reinterpret_cast<BufferedStream*>(stream);
+  return compressedWrite(stream->backend, id, s->data.data(), s->data.size(),
+                         s->type);
+}
+
+void bufferedFree(git_odb_stream* stream) {
+  delete reinterpret_cast<BufferedStream*>(stream);
+}
+
+int compressedWriteStream(
+    git_odb_stream** stream,
+    git_odb_backend* backend,
+    git_object_size_t size,
+    git_otype type) {
+  auto b = backendOf(backend);
+  if (size <= maxBufferedSize) {
+    auto s = new BufferedStream();
+    s->parent.backend = backend;
+    s->parent.mode = GIT_STREAM_WRONLY;
+    s->parent.write = bufferedWrite;
+    s->parent.finalize_write = bufferedFinalizeWrite;
+    s->parent.free = bufferedFree;
+    s->type = type;
+    s->data.reserve(size);
+    *stream = &s->parent;
+    return 0;
+  }
+
+  // The entropy of large objects is not checked. Level 0 is not supported
+  // by the loose backend, the fastest level is used instead.
+  int level = levelOf(b->policy, type, size);
+  auto loose = b->loose[level > 0 ? level : 1];
+  // Finishing the stream looks the object up in the database of the
+  // backend that opened it.
+  loose->odb = backend->odb;
+  return loose->writestream(stream, loose, size, type);
+}
+
+void compressedFree(git_odb_backend* backend) {
+  auto b = backendOf(backend);
+  for (auto loose : b->loose) {
+    if (loose) {
+      loose->free(loose);
+    }
+  }
+  delete b;
+}
+
+int clampLevel(int level) {
+  return level < 0 ? 1 : (level >= levels ? levels - 1 : level);
+}
+
+}
+
+double estimateEntropy(const void* data, size_t size) {
+  size_t n = size < entropySampleSize ? size : entropySampleSize;
+  if (n == 0) {
+    return 0;
+  }
+  size_t counts[256] = {0};
+  auto p = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < n; ++i) {
+    ++counts[p[i]];
+  }
+  double ret = 0;
+  for (auto c : counts) {
+    if (c > 0) {
+      double f = (double) c / n;
+      ret -= f * log2(f);
+    }
+  }
+  return ret;
+}
+
+git_odb_backend* createCompressionBackend(
+    const string& objectsDir,
+    const CompressionPolicy& policy,
+    bool syncWrites) {
+  auto b = new CompressionBackend();
+  git_odb_init_backend(&b->parent, GIT_ODB_BACKEND_VERSION);
+  b->parent.write = compressedWrite;
+  b->parent.writestream = compressedWriteStream;
+  b->parent.free = compressedFree;
+  b->policy = policy;
+  b->policy.blobLevel = clampLevel(policy.blobLevel);
+  b->policy.smallBlobLevel = clampLevel(policy.smallBlobLevel);
+  b->policy.treeLevel = clampLevel(policy.treeLevel);
+  b->policy.commitLevel = clampLevel(policy.commitLevel);
+
+  b->objectsDir = objectsDir;
+  b->syncWrites = syncWrites;
+
+  for (int level : {1, b->policy.blobLevel, b->policy.smallBlobLevel,
+                    b->policy.treeLevel, b->policy.commitLevel}) {
+    if (level > 0 && b->loose[level] == nullptr &&
+        0 != git_odb_backend_loose(&b->loose[level], objectsDir.c_str(),
+                                   level, syncWrites, 0, 0)) {
+      compressedFree(&b->parent);
+      throw runtime_error("Fails to create a loose object backend");
+    }
+  }
+  return &b->parent;
+}
+
+} // libgit2pp
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "Wrapper.h"
+
+#include <string>
+
+namespace libgit2pp {
+
+/**
+ Create an object database backend that writes loose objects to
+ @param objectsDir with the zlib level @param policy picks for each
+ object. This is used by Repository::setCompressionPolicy().
+
+ The backend only writes. Objects are read by the loose backend of the
+ object database, as the files have the usual format whatever their
+ level. With @param syncWrites, files are synced to the disk as they are
+ written. Throws an exception if the backend can't be created.
+*/
+git_odb_backend* createCompressionBackend(
+    const std::string& objectsDir,
+    const CompressionPolicy& policy,
+    bool syncWrites = false);
+
+// Estimate the entropy of @param data in bits per byte from a sample.
+double estimateEntropy(const void* data, size_t size);
+
+} // libgit2pp
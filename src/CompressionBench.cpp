@@ -0,0 +1,100 @@
+#include "DiffGenerator.h"
+#include "Wrapper.h"
+#include "TestUtils.h"
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+
+using namespace libgit2pp;
+using namespace std;
+using namespace std::chrono;
+
+// Shape of the diffs, see LoadTest.
+const int avgFileSize = 4096*4;
+const int avgFileNumber = 16;
+const int avgOverlappingFileNumber = 1;
+const int avgDirDepth = 4;
+const int topDirFanout = 500;
+const int middleDirFanout = 5;
+const int leafDirFanout = 50;
+const int commits = 100;
+
+const string root("/tmp/CompressionBench");
+
+// Size of the objects of the repository in KB.
+long diskUsage() {
+  long ret = 0;
+  string cmd = "du -sk --apparent-size " + root + "/objects";
+  if (FILE* f = popen(cmd.c_str(), "r")) {
+    fscanf(f, "%ld", &ret);
+    pclose(f);
+  }
+  return ret;
+}
+
+// Commit @param commits diffs of the given entropy, with @param policy or
+// the default compression if it is nullptr.
+void run(double entropy, const char* name, const CompressionPolicy* policy) {
+  setupRoot(root);
+  Repository r(root, true);
+  if (policy) {
+    r.setCompressionPolicy(*policy);
+  }
+
+  DiffGenerator gen(
+      avgFileSize,
+      avgFileNumber,
+      avgOverlappingFileNumber,
+      avgDirDepth,
+      topDirFanout,
+      middleDirFanout,
+      leafDirFanout,
+      commits * avgFileNumber * 2);
+  gen.setEntropy(entropy);
+
+  int64_t elaps = 0;
+  for (int i = 0; i < commits; ++i) {
+    unordered_map<string, string> diff;
+    if (!gen.next(&diff)) {
+      throw runtime_error("Fails to generate next diff");
+    }
+    auto start = steady_clock::now();
+    string id = r.commit(
+        "HEAD",
+        "My Name",
+        "my.name@gmail.com",
+        "A testing commit",
+        diff,
+        unordered_set<string>());
+    elaps += duration_cast<microseconds>(steady_clock::now() - start).count();
+    if (id.empty()) {
+      throw runtime_error("Fails to create a commit");
+    }
+  }
+  cout << "entropy " << entropy << " bits/byte, " << name << ": avg "
+       << elaps / commits << " us per commit, " << diskUsage()
+       << " KB of objects" << endl;
+}
+
+main() {
+  Git2 git2;
+
+  CompressionPolicy smallest;
+  smallest.blobLevel = smallest.smallBlobLevel = 9;
+  smallest.treeLevel = smallest.commitLevel = 9;
+  smallest.storeEntropy = 9;
+
+  CompressionPolicy stored;
+  stored.blobLevel = stored.smallBlobLevel = 0;
+  stored.treeLevel = stored.commitLevel = 0;
+
+  CompressionPolicy tuned;
+
+  for (double entropy : {2.0, 5.17, 8.0}) {
+    run(entropy, "default", nullptr);
+    run(entropy, "level 9", &smallest);
+    run(entropy, "level 0", &stored);
+    run(entropy, "policy", &tuned);
+  }
+}
@@ -27,6 +27,7 @@ DiffGenerator::DiffGenerator(
           middleDirFanout_(middleDirFanout),
           leafDirFanout_(leafDirFanout),
           finalNumberOfFiles_(finalNumberOfFiles),
+          alphabetSize_(36),
           mt_(random_device()()),
           tree_(new PathTree) {
 }
@@ -34,6 +35,11 @@ DiffGenerator::DiffGenerator(
 DiffGenerator::~DiffGenerator() {
 }
 
+void DiffGenerator::setEntropy(double bitsPerByte) {
+  int size = std::round(pow(2, bitsPerByte));
+  alphabetSize_ = size < 1 ? 1 : (size > 256 ? 256 : size);
+}
+
 bool DiffGenerator::next(unordered_map<string, string>* addedFiles) {
   auto root = tree_->find("");
   if (root->totalFiles > finalNumberOfFiles_) {
@@ -177,10 +183,13 @@ string DiffGenerator::genFileData() {
 
   string ret;
   ret.resize(num);
-  uniform_int_distribution<> dis(0, 35);
+  uniform_int_distribution<> dis(0, alphabetSize_ - 1);
   for (int i = 0; i < num; ++i) {
     int val = dis(mt_);
-    if (val < 26) {
+    if (alphabetSize_ > 36) {
+      // Any byte.
+      ret[i] = (char)val;
+    } else if (val < 26) {
       ret[i] = 'A' + (char)val;
     } else {
       ret[i] = '0' + (char)(val - 26);
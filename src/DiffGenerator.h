@@ -54,6 +54,13 @@ class DiffGenerator {
   */
   bool next(std::unordered_map<std::string, std::string>* addedFiles);
 
+  /**
+   Set the entropy of the generated file contents, in bits per byte,
+   from 0 to 8. By default files are made of digits and capital letters,
+   about 5.2 bits per byte.
+  */
+  void setEntropy(double bitsPerByte);
+
   int getNumberOfFiles();
 
   int getNumberOfTopLevelDirectories();
@@ -70,6 +77,9 @@ class DiffGenerator {
   const int leafDirFanout_;
   const int finalNumberOfFiles_;
 
+  // Number of distinct bytes in file contents.
+  int alphabetSize_;
+
   std::mt19937 mt_;
 
   std::unique_ptr<PathTree> tree_;
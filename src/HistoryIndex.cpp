@@ -0,0 +1,323 @@
+#include "HistoryIndex.h"
+
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace libgit2pp {
+
+namespace {
+
+const uint32_t recordMagic = 0x48524543;  // "HREC"
+const uint32_t headsMagic = 0x48484458;   // "HHDX"
+const uint32_t headsVersion = 1;
+
+// Number of slots of a new table, a power of 2.
+const uint64_t initialCapacity = 1 << 16;
+
+// A record is followed by the path, with no terminating zero.
+struct RecordHeader {
+  uint32_t magic;
+  uint32_t pathSize;
+  // The offset of the previous record with the same hash plus 1, or 0.
+  uint64_t prev;
+  unsigned char commit[GIT_OID_RAWSZ];
+  uint32_t reserved;
+};
+
+// FNV-1a, so that hashes stay the same across runs and platforms.
+uint64_t hashPath(const string& path) {
+  uint64_t h = 14695981039346656037ULL;
+  for (unsigned char c : path) {
+    h = (h ^ c) * 1099511628211ULL;
+  }
+  return h;
+}
+
+bool readFully(int fd, void* buf, size_t size, uint64_t offset) {
+  auto p = static_cast<char*>(buf);
+  while (size > 0) {
+    ssize_t n = pread(fd, p, size, offset);
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+    offset += n;
+  }
+  return true;
+}
+
+} // namespace
+
+struct HistoryIndex::Header {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t capacity;
+  uint64_t count;
+  // The records are linked up to this offset.
+  uint64_t end;
+};
+
+// A slot of the table. Paths whose hashes are equal share a slot, and
+// their records are told apart by the path. An empty slot has head 0.
+struct HistoryIndex::Slot {
+  uint64_t hash;
+  // The offset of the last record plus 1.
+  uint64_t head;
+};
+
+HistoryIndex::HistoryIndex(const string& dir)
+  : dir_(dir), recordsFd_(-1), tail_(0),
+    headsFd_(-1), heads_(nullptr), headsSize_(0) {
+  mkdir(dir_.c_str(), 0755);
+  string path = dir_ + "/records";
+  recordsFd_ = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+  if (recordsFd_ < 0) {
+    throw runtime_error("Fails to open history records " + path);
+  }
+  struct stat st;
+  fstat(recordsFd_, &st);
+  tail_ = st.st_size;
+
+  mapHeads(dir_ + "/heads", initialCapacity, false);
+  recover();
+}
+
+HistoryIndex::~HistoryIndex() {
+  if (heads_) {
+    munmap(heads_, headsSize_);
+  }
+  if (headsFd_ >= 0) {
+    close(headsFd_);
+  }
+  if (recordsFd_ >= 0) {
+    close(recordsFd_);
+  }
+}
+
+HistoryIndex::Slot* HistoryIndex::slots() {
+  return reinterpret_cast<Slot*>(heads_ + 1);
+}
+
+void HistoryIndex::mapHeads(
+    const string& path,
+    uint64_t capacity,
+    bool create) {
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | (create ? O_TRUNC : 0),
+                0644);
+  if (fd < 0) {
+    throw runtime_error("Fails to open history heads " + path);
+  }
+  struct stat st;
+  fstat(fd, &st);
+
+  // A table that doesn't fit the records is rebuilt from them.
+  Header header;
+  bool valid = (size_t) st.st_size >= sizeof(header) &&
+      readFully(fd, &header, sizeof(header), 0) &&
+      header.magic == headsMagic && header.version == headsVersion &&
+      header.capacity > 0 && (header.capacity & (header.capacity - 1)) == 0 &&
+      (uint64_t) st.st_size == sizeof(header) + header.capacity * sizeof(Slot) &&
+      header.end <= tail_;
+  if (!valid) {
+    header.magic = headsMagic;
+    header.version = headsVersion;
+    header.capacity = capacity;
+    header.count = 0;
+    header.end = 0;
+    size_t size = sizeof(header) + capacity * sizeof(Slot);
+    // The file is sparse, and empty slots read as zeros.
+    if (0 != ftruncate(fd, 0) || 0 != ftruncate(fd, size) ||
+        sizeof(header) != pwrite(fd, &header, sizeof(header), 0)) {
+      close(fd);
+      throw runtime_error("Fails to create history heads " + path);
+    }
+  }
+
+  size_t size = sizeof(header) + header.capacity * sizeof(Slot);
+  void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED) {
+    close(fd);
+    throw runtime_error("Fails to map history heads " + path);
+  }
+  if (heads_) {
+    munmap(heads_, headsSize_);
+    close(headsFd_);
+  }
+  heads_ = static_cast<Header*>(p);
+  headsSize_ = size;
+  headsFd_ = fd;
+}
+
+void HistoryIndex::growHeads() {
+  // Rehash into a new file, then replace the table with it.
+  string path = dir_ + "/heads";
+  string tmp = path + ".tmp";
+  auto old = heads_;
+  auto oldSize = headsSize_;
+  auto oldFd = headsFd_;
+  heads_ = nullptr;
+  headsFd_ = -1;
+  mapHeads(tmp, old->capacity * 2, true);
+
+  auto oldSlots = reinterpret_cast<Slot*>(old + 1);
+  for (uint64_t i = 0; i < old->capacity; ++i) {
+    if (oldSlots[i].head != 0) {
+      Slot* s = findSlot(oldSlots[i].hash);
+      *s = oldSlots[i];
+      ++heads_->count;
+    }
+  }
+  heads_->end = old->end;
+  munmap(old, oldSize);
+  close(oldFd);
+
+  if (0 != rename(tmp.c_str(), path.c_str())) {
+    throw runtime_error("Fails to replace history heads " + path);
+  }
+}
+
+HistoryIndex::Slot* HistoryIndex::findSlot(uint64_t hash) {
+  uint64_t mask = heads_->capacity - 1;
+  for (uint64_t i = hash & mask; ; i = (i + 1) & mask) {
+    Slot* s = &slots()[i];
+    if (s->head == 0 || s->hash == hash) {
+      return s;
+    }
+  }
+}
+
+void HistoryIndex::link(uint64_t hash, uint64_t offset) {
+  Slot* s = findSlot(hash);
+  if (s->head == 0) {
+    // Keep the load factor under 1/2 so that probes stay short.
+    if ((heads_->count + 1) * 2 > heads_->capacity) {
+      growHeads();
+      s = findSlot(hash);
+    }
+    s->hash = hash;
+    ++heads_->count;
+  }
+  s->head = offset + 1;
+}
+
+void HistoryIndex::recover() {
+  uint64_t offset = heads_->end;
+  string path;
+  while (offset < tail_) {
+    RecordHeader header;
+    bool ok = offset + sizeof(header) <= tail_ &&
+        readFully(recordsFd_, &header, sizeof(header), offset) &&
+        header.magic == recordMagic &&
+        header.pathSize <= tail_ - offset - sizeof(header) &&
+        header.prev <= offset;
+    if (ok) {
+      path.resize(header.pathSize);
+      ok = readFully(recordsFd_, &path[0], path.size(),
+                     offset + sizeof(header));
+    }
+    if (!ok) {
+      cerr << "Truncates history records at " << offset << endl;
+      if (0 != ftruncate(recordsFd_, offset)) {
+        throw runtime_error("Fails to truncate history records");
+      }
+      tail_ = offset;
+      break;
+    }
+    link(hashPath(path), offset);
+    offset += sizeof(header) + header.pathSize;
+  }
+  heads_->end = tail_;
+}
+
+bool HistoryIndex::add(const git_oid* commit, const vector<string>& paths) {
+  // All the records of the commit are written at once, and linked once
+  // they are all in the file.
+  string buf;
+  vector<pair<uint64_t, uint64_t>> links;
+  links.reserve(paths.size());
+  unordered_map<uint64_t, uint64_t> heads;
+  for (auto& path : paths) {
+    uint64_t hash = hashPath(path);
+    uint64_t offset = tail_ + buf.size();
+    RecordHeader header;
+    header.magic = recordMagic;
+    header.pathSize = path.size();
+    auto it = heads.find(hash);
+    header.prev = (it != heads.end() ? it->second : findSlot(hash)->head);
+    memcpy(header.commit, commit->id, GIT_OID_RAWSZ);
+    header.reserved = 0;
+    buf.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    buf += path;
+    heads[hash] = offset + 1;
+    links.emplace_back(hash, offset);
+  }
+  if ((ssize_t) buf.size() != pwrite(recordsFd_, buf.data(), buf.size(),
+                                     tail_)) {
+    // Drop what may have been written, so the tail stays intact.
+    ftruncate(recordsFd_, tail_);
+    return false;
+  }
+  for (auto& l : links) {
+    link(l.first, l.second);
+  }
+  tail_ += buf.size();
+  heads_->end = tail_;
+  return true;
+}
+
+bool HistoryIndex::find(
+    const string& path,
+    size_t limit,
+    const function<bool(const git_oid*)>& visit) {
+  string name;
+  uint64_t next = findSlot(hashPath(path))->head;
+  for (size_t visited = 0; next != 0 && visited < limit; ) {
+    uint64_t offset = next - 1;
+    RecordHeader header;
+    if (offset + sizeof(header) > heads_->end ||
+        !readFully(recordsFd_, &header, sizeof(header), offset) ||
+        header.magic != recordMagic || header.prev > offset) {
+      cerr << "Fails to read history record at " << offset << endl;
+      return false;
+    }
+    // Records of other paths with the same hash are skipped.
+    if (header.pathSize == path.size()) {
+      name.resize(path.size());
+      if (!readFully(recordsFd_, &name[0], name.size(),
+                     offset + sizeof(header))) {
+        return false;
+      }
+      if (name == path) {
+        git_oid id;
+        git_oid_fromraw(&id, header.commit);
+        ++visited;
+        if (!visit(&id)) {
+          break;
+        }
+      }
+    }
+    next = header.prev;
+  }
+  return true;
+}
+
+void HistoryIndex::clear() {
+  if (0 != ftruncate(recordsFd_, 0)) {
+    throw runtime_error("Fails to truncate history records");
+  }
+  tail_ = 0;
+  mapHeads(dir_ + "/heads", initialCapacity, true);
+}
+
+} // libgit2pp
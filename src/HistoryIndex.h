@@ -0,0 +1,78 @@
+#pragma once
+
+#include "git2.h"
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace libgit2pp {
+
+/**
+ An on-disk index from paths to the commits that changed them. This is
+ used by Repository::useHistoryIndex().
+
+ Commits are appended to "records" in @param dir, one record per changed
+ path, each holding the commit ID, the path, and the offset of the
+ previous record of the same path. "heads", a memory-mapped
+ open-addressing hash table from the hash of a path to its last record,
+ starts the chains, and records how much of the log it covers. Looking
+ up a path reads its chain backwards, newest first, without reading any
+ git object.
+
+ When the index is opened, records past the covered end are linked into
+ the table again, and a torn record at the tail, left by a crash, is cut
+ off. Records are not synced, as the index can be rebuilt from history.
+
+ The index is not thread-safe, and only one index may use a folder at a
+ time. Throws an exception if the index can't be opened.
+*/
+class HistoryIndex {
+ public:
+  explicit HistoryIndex(const std::string& dir);
+  ~HistoryIndex();
+
+  HistoryIndex(const HistoryIndex&) = delete;
+  HistoryIndex& operator=(const HistoryIndex&) = delete;
+
+  // Record that @param commit changed each of @param paths, which must be
+  // distinct. Returns false if the records can't be written.
+  bool add(const git_oid* commit, const std::vector<std::string>& paths);
+
+  /**
+   Visit the commits recorded for @param path, newest first.
+
+   @param limit the lookup stops after visiting this many commits.
+   @param visit called with each commit ID, and returns false to stop.
+   @returns false if a record can't be read.
+  */
+  bool find(
+      const std::string& path,
+      size_t limit,
+      const std::function<bool(const git_oid*)>& visit);
+
+  // Drop every record. Throws an exception if the files can't be reset.
+  void clear();
+
+ private:
+  struct Header;
+  struct Slot;
+
+  const std::string dir_;
+  int recordsFd_;
+  uint64_t tail_;
+
+  int headsFd_;
+  Header* heads_;
+  size_t headsSize_;
+
+  Slot* slots();
+  Slot* findSlot(uint64_t hash);
+  void link(uint64_t hash, uint64_t offset);
+  void mapHeads(const std::string& path, uint64_t capacity, bool create);
+  void growHeads();
+  void recover();
+};
+
+} // libgit2pp
@@ -0,0 +1,54 @@
+#include "Wrapper.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+using namespace libgit2pp;
+using namespace std;
+using namespace std::chrono;
+
+void usage() {
+  cerr << "Usage: history_index REPO rebuild [COMMIT]" << endl
+       << "       history_index REPO log PATH [LIMIT]" << endl
+       << "  rebuild  index the history of COMMIT, or HEAD" << endl
+       << "  log      list the indexed commits that change PATH" << endl;
+  exit(1);
+}
+
+main(int argc, char** argv) {
+  if (argc < 3) {
+    usage();
+  }
+  Git2 git2;
+  Repository r(argv[1]);
+
+  if (0 == strcmp(argv[2], "rebuild") && argc <= 4) {
+    auto start = steady_clock::now();
+    if (!r.rebuildHistoryIndex(argc == 4 ? argv[3] : "")) {
+      cerr << "Fails to rebuild the history index" << endl;
+      return 1;
+    }
+    auto end = steady_clock::now();
+    cout << "Rebuilt the history index in "
+         << duration_cast<milliseconds>(end - start).count() << " ms"
+         << endl;
+  } else if (0 == strcmp(argv[2], "log") && argc >= 4 && argc <= 5) {
+    size_t limit = argc == 5 ? strtoull(argv[4], nullptr, 10) : SIZE_MAX;
+    r.useHistoryIndex();
+    bool ok = r.historyOf(argv[3], limit, [](const git_oid* id) {
+      char hex[GIT_OID_HEXSZ + 1];
+      git_oid_tostr(hex, sizeof(hex), id);
+      cout << hex << endl;
+      return true;
+    });
+    if (!ok) {
+      cerr << "Fails to read the history index" << endl;
+      return 1;
+    }
+  } else {
+    usage();
+  }
+  return 0;
+}
@@ -3,6 +3,7 @@
 #include "TestUtils.h"
 
 #include <chrono>
+#include <cstring>
 #include <sstream>
 #include <iostream>
 
@@ -21,7 +22,65 @@ const int finalNumberOfFiles = 300000;
 
 const string root("/tmp/LoadTest");
 
-main() {
+void usage() {
+  cerr << "Usage: load_test [--log] [--refdb] [--durability MODE]"
+       << " [--files N]" << endl
+       << "  --log      write objects to the append-only log backend" << endl
+       << "  --refdb    keep references in memory" << endl
+       << "  --durability none|group|strict" << endl
+       << "             how commits are synced to the disk" << endl
+       << "  --files N  stop once N files are created" << endl;
+  exit(1);
+}
+
+// Measure the average latency of reading @param ids back from a new
+// repository handle, so that no object is cached.
+int64_t measureReads(bool useLog, const vector<git_oid>& ids) {
+  Repository r(root);
+  if (useLog) {
+    r.useLogBackend();
+  }
+  unique_ptr<git_odb> odb(r.getOdb());
+  auto start = steady_clock::now();
+  for (auto& id : ids) {
+    git_odb_object* obj = nullptr;
+    if (0 != git_odb_read(&obj, odb.get(), &id)) {
+      throw runtime_error("Fails to read an object");
+    }
+    git_odb_object_free(obj);
+  }
+  auto end = steady_clock::now();
+  return ids.empty() ? 0 :
+      duration_cast<microseconds>(end - start).count() / ids.size();
+}
+
+main(int argc, char** argv) {
+  bool useLog = false;
+  bool useRefdb = false;
+  string durabilityName = "none";
+  Durability durability = Durability::None;
+  int numberOfFiles = finalNumberOfFiles;
+  for (int i = 1; i < argc; ++i) {
+    if (0 == strcmp(argv[i], "--log")) {
+      useLog = true;
+    } else if (0 == strcmp(argv[i], "--refdb")) {
+      useRefdb = true;
+    } else if (0 == strcmp(argv[i], "--durability") && i + 1 < argc) {
+      durabilityName = argv[++i];
+      if (durabilityName == "group") {
+        durability = Durability::Group;
+      } else if (durabilityName == "strict") {
+        durability = Durability::Strict;
+      } else if (durabilityName != "none") {
+        usage();
+      }
+    } else if (0 == strcmp(argv[i], "--files") && i + 1 < argc) {
+      numberOfFiles = atoi(argv[++i]);
+    } else {
+      usage();
+    }
+  }
+
   Git2 git2;
   setupRoot(root);
 
@@ -32,6 +91,13 @@ main() {
   } catch (const exception& ex) {
     throw runtime_error("Fails to create a new git repository");
   }
+  if (useLog) {
+    r->useLogBackend();
+  }
+  if (useRefdb) {
+    r->useMemoryRefdb();
+  }
+  r->setDurability(durability);
 
   DiffGenerator gen(
       avgFileSize,
@@ -41,16 +107,26 @@ main() {
       topDirFanout,
       middleDirFanout,
       leafDirFanout,
-      finalNumberOfFiles);
+      numberOfFiles);
 
   // Measures total time spent on commit.
   int64_t elaps = 0;
+  int64_t total = 0;
+  int commits = 0;
 
-  for (int i = 0; gen.getNumberOfFiles() < finalNumberOfFiles; ++i) {
+  // One blob of each commit is read back at the end.
+  vector<git_oid> samples;
+
+  for (int i = 0; gen.getNumberOfFiles() < numberOfFiles; ++i) {
     unordered_map<string, string> diff;
     if (!gen.next(&diff)) {
       throw runtime_error("Fails to generate next diff");
     }
+    if (!diff.empty()) {
+      auto& data = diff.begin()->second;
+      samples.emplace_back();
+      git_odb_hash(&samples.back(), data.data(), data.size(), GIT_OBJ_BLOB);
+    }
 
     string commitMessage;
     {
@@ -77,12 +153,22 @@ main() {
     if (id.empty()) {
       throw runtime_error("Fails to create a commit");
     }
+    ++commits;
 
     if (i % 50 == 49) {
       auto avg = elaps / 50;
+      total += elaps;
       elaps = 0;
       cerr << "At " << i << "th commits, " << gen.getNumberOfFiles()
            << " of files created avg " << avg << " us" << endl;
     }
   }
+  total += elaps;
+  r.reset();
+
+  cerr << (useLog ? "log" : "loose") << " backend, " << durabilityName
+       << " durability: " << commits << " commits, avg commit "
+       << (commits ? total / commits : 0) << " us, "
+       << (total ? commits * 1000000 / total : 0) << " commits/s, avg read "
+       << measureReads(useLog, samples) << " us" << endl;
 }
@@ -0,0 +1,639 @@
+#include "LogBackend.h"
+#include "git2/sys/odb_backend.h"
+
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace libgit2pp {
+
+namespace {
+
+const uint32_t recordMagic = 0x474c4f47;  // "GLOG"
+const uint32_t indexMagic = 0x47494458;   // "GIDX"
+const uint32_t indexVersion = 1;
+
+// Number of slots of a new index, a power of 2.
+const uint64_t initialIndexCapacity = 1 << 16;
+
+struct RecordHeader {
+  uint32_t magic;
+  uint32_t type;
+  uint64_t size;
+  unsigned char id[GIT_OID_RAWSZ];
+  uint32_t reserved;
+};
+
+struct IndexHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t capacity;
+  uint64_t count;
+  // The log is indexed up to offset end of this segment.
+  uint64_t segment;
+  uint64_t end;
+};
+
+// A slot of the index. Segments are numbered from 1, so an empty slot
+// has segment 0.
+struct Slot {
+  unsigned char id[GIT_OID_RAWSZ];
+  uint32_t segment;
+  uint64_t offset;
+};
+
+string segmentName(uint64_t segment) {
+  char name[32];
+  snprintf(name, sizeof(name), "segment-%08llu.log",
+           (unsigned long long) segment);
+  return name;
+}
+
+bool readFully(int fd, void* buf, size_t size, uint64_t offset) {
+  auto p = static_cast<char*>(buf);
+  while (size > 0) {
+    ssize_t n = pread(fd, p, size, offset);
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+    offset += n;
+  }
+  return true;
+}
+
+class LogStore {
+ public:
+  LogStore(const string& dir, size_t maxSegmentSize, bool syncWrites);
+  ~LogStore();
+
+  bool exists(const git_oid* id);
+  // Read the header of the record of @param id, and copy its slot into
+  // @param slot if not null. The lock must be held.
+  int readHeader(const git_oid* id, RecordHeader* header, Slot* slot);
+  int read(git_odb_backend* backend, const git_oid* id, void** data,
+           size_t* size, git_otype* type);
+  int write(const git_oid* id, const void* data, size_t size, git_otype type);
+  // Find the only object whose ID starts with the first @param len hex
+  // digits of @param prefix.
+  int findPrefix(const git_oid* prefix, size_t len, git_oid* id);
+  vector<git_oid> ids();
+
+ private:
+  const string dir_;
+  const size_t maxSegmentSize_;
+  const bool syncWrites_;
+  mutex mutex_;
+
+  // File descriptors of the segments, the last one being written.
+  vector<int> segments_;
+  uint64_t tail_;
+
+  int indexFd_;
+  IndexHeader* index_;
+  size_t indexSize_;
+
+  Slot* slots() { return reinterpret_cast<Slot*>(index_ + 1); }
+  const Slot* find(const git_oid* id);
+  void insert(const git_oid* id, uint32_t segment, uint64_t offset);
+  void mapIndex(const string& path, uint64_t capacity, bool create);
+  void growIndex();
+  void openSegment(uint64_t segment, bool create);
+  void recover();
+};
+
+LogStore::LogStore(const string& dir, size_t maxSegmentSize, bool syncWrites)
+  : dir_(dir), maxSegmentSize_(maxSegmentSize), syncWrites_(syncWrites),
+    tail_(0), indexFd_(-1),
+    index_(nullptr), indexSize_(0) {
+  mkdir(dir_.c_str(), 0755);
+
+  // Segments are numbered from 1 with no gaps.
+  uint64_t count = 0;
+  if (DIR* d = opendir(dir_.c_str())) {
+    while (auto e = readdir(d)) {
+      unsigned long long n;
+      if (1 == sscanf(e->d_name, "segment-%llu.log", &n) && n > count) {
+        count = n;
+      }
+    }
+    closedir(d);
+  } else {
+    throw runtime_error("Fails to open the log folder " + dir_);
+  }
+  for (uint64_t s = 1; s <= count; ++s) {
+    openSegment(s, false);
+  }
+  if (segments_.empty()) {
+    openSegment(1, true);
+  }
+
+  mapIndex(dir_ + "/index", initialIndexCapacity, false);
+  recover();
+}
+
+LogStore::~LogStore() {
+  if (index_) {
+    munmap(index_, indexSize_);
+  }
+  if (indexFd_ >= 0) {
+    close(indexFd_);
+  }
+  for (int fd : segments_) {
+    close(fd);
+  }
+}
+
+void LogStore::openSegment(uint64_t segment, bool create) {
+  string path = dir_ + "/" + segmentName(segment);
+  int fd = open(path.c_str(), O_RDWR | (create ? O_CREAT | O_EXCL : 0), 0644);
+  if (fd < 0) {
+    throw runtime_error("Fails to open log segment " + path);
+  }
+  segments_.push_back(fd);
+  struct stat st;
+  fstat(fd, &st);
+  tail_ = st.st_size;
+}
+
+void LogStore::mapIndex(const string& path, uint64_t capacity, bool create) {
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | (create ? O_TRUNC : 0),
+                0644);
+  if (fd < 0) {
+    throw runtime_error("Fails to open log index " + path);
+  }
+  struct stat st;
+  fstat(fd, &st);
+
+  // An index that doesn't fit the log is rebuilt from the segments.
+  IndexHeader header;
+  bool valid = (size_t) st.st_size >= sizeof(header) &&
+      readFully(fd, &header, sizeof(header), 0) &&
+      header.magic == indexMagic && header.version == indexVersion &&
+      header.capacity > 0 && (header.capacity & (header.capacity - 1)) == 0 &&
+      (uint64_t) st.st_size == sizeof(header) + header.capacity * sizeof(Slot) &&
+      header.segment >= 1 && header.segment <= segments_.size();
+  if (valid) {
+    struct stat seg;
+    fstat(segments_[header.segment - 1], &seg);
+    valid = header.end <= (uint64_t) seg.st_size;
+  }
+  if (!valid) {
+    header.magic = indexMagic;
+    header.version = indexVersion;
+    header.capacity = capacity;
+    header.count = 0;
+    header.segment = 1;
+    header.end = 0;
+    size_t size = sizeof(header) + capacity * sizeof(Slot);
+    // The file is sparse, and empty slots read as zeros.
+    if (0 != ftruncate(fd, 0) || 0 != ftruncate(fd, size) ||
+        sizeof(header) != pwrite(fd, &header, sizeof(header), 0)) {
+      close(fd);
+      throw runtime_error("Fails to create log index " + path);
+    }
+  }
+
+  size_t size = sizeof(header) + header.capacity * sizeof(Slot);
+  void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED) {
+    close(fd);
+    throw runtime_error("Fails to map log index " + path);
+  }
+  if (index_) {
+    munmap(index_, indexSize_);
+    close(indexFd_);
+  }
+  index_ = static_cast<IndexHeader*>(p);
+  indexSize_ = size;
+  indexFd_ = fd;
+}
+
+void LogStore::growIndex() {
+  // Rehash into a new file, then replace the index with it.
+  string path = dir_ + "/index";
+  string tmp = path + ".tmp";
+  auto old = index_;
+  auto oldSize = indexSize_;
+  auto oldFd = indexFd_;
+  index_ = nullptr;
+  indexFd_ = -1;
+  try {
+    mapIndex(tmp, old->capacity * 2, true);
+  } catch (...) {
+    // Keep the old index, so the store stays usable.
+    index_ = old;
+    indexFd_ = oldFd;
+    throw;
+  }
+
+  auto oldSlots = reinterpret_cast<Slot*>(old + 1);
+  for (uint64_t i = 0; i < old->capacity; ++i) {
+    if (oldSlots[i].segment != 0) {
+      git_oid id;
+      git_oid_fromraw(&id, oldSlots[i].id);
+      insert(&id, oldSlots[i].segment, oldSlots[i].offset);
+    }
+  }
+  index_->segment = old->segment;
+  index_->end = old->end;
+  munmap(old, oldSize);
+  close(oldFd);
+
+  if (0 != rename(tmp.c_str(), path.c_str())) {
+    throw runtime_error("Fails to replace log index " + path);
+  }
+}
+
+const Slot* LogStore::find(const git_oid* id) {
+  uint64_t mask = index_->capacity - 1;
+  uint64_t h;
+  memcpy(&h, id->id, sizeof(h));
+  for (uint64_t i = h & mask; ; i = (i + 1) & mask) {
+    const Slot& s = slots()[i];
+    if (s.segment == 0) {
+      return nullptr;
+    }
+    if (0 == memcmp(s.id, id->id, GIT_OID_RAWSZ)) {
+      return &s;
+    }
+  }
+}
+
+void LogStore::insert(const git_oid* id, uint32_t segment, uint64_t offset) {
+  // Keep the load factor under 1/2 so that probes stay short.
+  if ((index_->count + 1) * 2 > index_->capacity) {
+    growIndex();
+  }
+  uint64_t mask = index_->capacity - 1;
+  uint64_t h;
+  memcpy(&h, id->id, sizeof(h));
+  for (uint64_t i = h & mask; ; i = (i + 1) & mask) {
+    Slot& s = slots()[i];
+    if (s.segment == 0) {
+      memcpy(s.id, id->id, GIT_OID_RAWSZ);
+      s.offset = offset;
+      s.segment = segment;
+      ++index_->count;
+      return;
+    }
+    if (0 == memcmp(s.id, id->id, GIT_OID_RAWSZ)) {
+      return;
+    }
+  }
+}
+
+void LogStore::recover() {
+  vector<char> data;
+  for (uint64_t s = index_->segment; s <= segments_.size(); ++s) {
+    int fd = segments_[s - 1];
+    struct stat st;
+    fstat(fd, &st);
+    uint64_t offset = (s == index_->segment) ? index_->end : 0;
+    while (offset < (uint64_t) st.st_size) {
+      RecordHeader header;
+      git_oid id, actual;
+      bool ok = offset + sizeof(header) <= (uint64_t) st.st_size &&
+          readFully(fd, &header, sizeof(header), offset) &&
+          header.magic == recordMagic &&
+          header.size <= st.st_size - offset - sizeof(header);
+      if (ok) {
+        data.resize(header.size);
+        git_oid_fromraw(&id, header.id);
+        ok = readFully(fd, data.data(), data.size(), offset + sizeof(header)) &&
+            0 == git_odb_hash(&actual, data.data(), data.size(),
+                              (git_otype) header.type) &&
+            git_oid_equal(&id, &actual);
+      }
+      if (!ok) {
+        cerr << "Truncates " << segmentName(s) << " at " << offset << endl;
+        if (0 != ftruncate(fd, offset)) {
+          throw runtime_error("Fails to truncate log segment");
+        }
+        // The log must have no holes, so the segments after a corrupt
+        // one are dropped, and writes go on from where it was cut.
+        while (segments_.size() > s) {
+          cerr << "Drops " << segmentName(segments_.size()) << endl;
+          close(segments_.back());
+          string path = dir_ + "/" + segmentName(segments_.size());
+          segments_.pop_back();
+          if (0 != unlink(path.c_str())) {
+            throw runtime_error("Fails to drop log segment " + path);
+          }
+        }
+        break;
+      }
+      insert(&id, s, offset);
+      offset += sizeof(header) + header.size;
+    }
+  }
+  index_->segment = segments_.size();
+  struct stat st;
+  fstat(segments_.back(), &st);
+  index_->end = tail_ = st.st_size;
+}
+
+bool LogStore::exists(const git_oid* id) {
+  lock_guard<mutex> lock(mutex_);
+  return find(id) != nullptr;
+}
+
+int LogStore::readHeader(
+    const git_oid* id,
+    RecordHeader* header,
+    Slot* slot) {
+  const Slot* s = find(id);
+  if (s == nullptr) {
+    return GIT_ENOTFOUND;
+  }
+  if (!readFully(segments_[s->segment - 1], header, sizeof(*header),
+                 s->offset) ||
+      header->magic != recordMagic ||
+      0 != memcmp(header->id, id->id, GIT_OID_RAWSZ)) {
+    return GIT_ERROR;
+  }
+  if (slot) {
+    *slot = *s;
+  }
+  return 0;
+}
+
+int LogStore::read(
+    git_odb_backend* backend,
+    const git_oid* id,
+    void** data,
+    size_t* size,
+    git_otype* type) {
+  // The contents are read without the lock, from copies of the slot and
+  // header, as the index may be remapped by a write in the meantime.
+  // Segments are only closed with the store, and records never move.
+  RecordHeader header;
+  Slot s;
+  int fd;
+  {
+    lock_guard<mutex> lock(mutex_);
+    int ret = readHeader(id, &header, &s);
+    if (ret != 0) {
+      return ret;
+    }
+    fd = segments_[s.segment - 1];
+  }
+  if (data == nullptr) {
+    *size = header.size;
+    *type = (git_otype) header.type;
+    return 0;
+  }
+  void* buf = git_odb_backend_malloc(backend, header.size);
+  if (buf == nullptr) {
+    return GIT_ERROR;
+  }
+  if (!readFully(fd, buf, header.size, s.offset + sizeof(header))) {
+    git_odb_backend_data_free(backend, buf);
+    return GIT_ERROR;
+  }
+  *data = buf;
+  *size = header.size;
+  *type = (git_otype) header.type;
+  return 0;
+}
+
+int LogStore::write(
+    const git_oid* id,
+    const void* data,
+    size_t size,
+    git_otype type) {
+  lock_guard<mutex> lock(mutex_);
+  if (find(id) != nullptr) {
+    return 0;
+  }
+
+  RecordHeader header;
+  header.magic = recordMagic;
+  header.type = type;
+  header.size = size;
+  memcpy(header.id, id->id, GIT_OID_RAWSZ);
+  header.reserved = 0;
+  size_t total = sizeof(header) + size;
+
+  if (tail_ > 0 && tail_ + total > maxSegmentSize_) {
+    openSegment(segments_.size() + 1, true);
+  }
+
+  struct iovec iov[2] = {
+    { &header, sizeof(header) },
+    { const_cast<void*>(data), size },
+  };
+  if ((ssize_t) total != pwritev(segments_.back(), iov, 2, tail_)) {
+    // Drop what may have been written, so the tail stays intact.
+    ftruncate(segments_.back(), tail_);
+    return GIT_ERROR;
+  }
+  // The index is rebuilt from the log after a crash, so only the record
+  // needs to be synced.
+  if (syncWrites_ && 0 != fdatasync(segments_.back())) {
+    ftruncate(segments_.back(), tail_);
+    return GIT_ERROR;
+  }
+  insert(id, segments_.size(), tail_);
+  tail_ += total;
+  index_->segment = segments_.size();
+  index_->end = tail_;
+  return 0;
+}
+
+int LogStore::findPrefix(const git_oid* prefix, size_t len, git_oid* id) {
+  lock_guard<mutex> lock(mutex_);
+  if (len >= GIT_OID_HEXSZ) {
+    if (find(prefix) == nullptr) {
+      return GIT_ENOTFOUND;
+    }
+    git_oid_cpy(id, prefix);
+    return 0;
+  }
+  bool found = false;
+  for (uint64_t i = 0; i < index_->capacity; ++i) {
+    if (slots()[i].segment == 0) {
+      continue;
+    }
+    git_oid candidate;
+    git_oid_fromraw(&candidate, slots()[i].id);
+    if (0 == git_oid_ncmp(&candidate, prefix, len)) {
+      if (found) {
+        return GIT_EAMBIGUOUS;
+      }
+      found = true;
+      git_oid_cpy(id, &candidate);
+    }
+  }
+  return found ? 0 : GIT_ENOTFOUND;
+}
+
+vector<git_oid> LogStore::ids() {
+  lock_guard<mutex> lock(mutex_);
+  vector<git_oid> ret;
+  ret.reserve(index_->count);
+  for (uint64_t i = 0; i < index_->capacity; ++i) {
+    if (slots()[i].segment != 0) {
+      git_oid id;
+      git_oid_fromraw(&id, slots()[i].id);
+      ret.push_back(id);
+    }
+  }
+  return ret;
+}
+
+// The backend handed to libgit2. It only forwards to the store.
+struct LogBackend {
+  git_odb_backend parent;
+  LogStore* store;
+};
+
+LogStore* storeOf(git_odb_backend* backend) {
+  return reinterpret_cast<LogBackend*>(backend)->store;
+}
+
+// Exceptions must not unwind through libgit2, so the store's are turned
+// into errors here, with the message kept as the last git error.
+template <typename F>
+int guarded(F f) {
+  try {
+    return f();
+  } catch (const exception& e) {
+    giterr_set_str(GITERR_ODB, e.what());
+    return GIT_ERROR;
+  }
+}
+
+int logRead(
+    void** data,
+    size_t* size,
+    git_otype* type,
+    git_odb_backend* backend,
+    const git_oid* id) {
+  return guarded([&] {
+    return storeOf(backend)->read(backend, id, data, size, type);
+  });
+}
+
+int logReadHeader(
+    size_t* size,
+    git_otype* type,
+    git_odb_backend* backend,
+    const git_oid* id) {
+  return guarded([&] {
+    return storeOf(backend)->read(backend, id, nullptr, size, type);
+  });
+}
+
+int logReadPrefix(
+    git_oid* out,
+    void** data,
+    size_t* size,
+    git_otype* type,
+    git_odb_backend* backend,
+    const git_oid* prefix,
+    size_t len) {
+  return guarded([&] {
+    int ret = storeOf(backend)->findPrefix(prefix, len, out);
+    if (ret != 0) {
+      return ret;
+    }
+    return storeOf(backend)->read(backend, out, data, size, type);
+  });
+}
+
+int logWrite(
+    git_odb_backend* backend,
+    const git_oid* id,
+    const void* data,
+    size_t size,
+    git_otype type) {
+  return guarded([&] {
+    return storeOf(backend)->write(id, data, size, type);
+  });
+}
+
+int logExists(git_odb_backend* backend, const git_oid* id) {
+  // libgit2 reads any nonzero value as found, so a failure is "missing".
+  int ret = guarded([&] {
+    return storeOf(backend)->exists(id) ? 1 : 0;
+  });
+  return ret == 1 ? 1 : 0;
+}
+
+int logExistsPrefix(
+    git_oid* out,
+    git_odb_backend* backend,
+    const git_oid* prefix,
+    size_t len) {
+  return guarded([&] {
+    return storeOf(backend)->findPrefix(prefix, len, out);
+  });
+}
+
+int logFreshen(git_odb_backend* backend, const git_oid* id) {
+  return guarded([&] {
+    return storeOf(backend)->exists(id) ? 0 : GIT_ENOTFOUND;
+  });
+}
+
+int logForeach(git_odb_backend* backend, git_odb_foreach_cb cb, void* payload) {
+  // The callback may read objects, so it runs without holding the lock.
+  vector<git_oid> ids;
+  int ret = guarded([&] {
+    ids = storeOf(backend)->ids();
+    return 0;
+  });
+  if (ret != 0) {
+    return ret;
+  }
+  for (auto& id : ids) {
+    ret = cb(&id, payload);
+    if (ret != 0) {
+      return ret;
+    }
+  }
+  return 0;
+}
+
+void logFree(git_odb_backend* backend) {
+  delete storeOf(backend);
+  delete reinterpret_cast<LogBackend*>(backend);
+}
+
+}
+
+git_odb_backend* createLogBackend(
+    const string& dir,
+    size_t maxSegmentSize,
+    bool syncWrites) {
+  unique_ptr<LogStore> store(new LogStore(dir, maxSegmentSize, syncWrites));
+  auto backend = new LogBackend();
+  git_odb_init_backend(&backend->parent, GIT_ODB_BACKEND_VERSION);
+  backend->parent.read = logRead;
+  backend->parent.read_header = logReadHeader;
+  backend->parent.read_prefix = logReadPrefix;
+  backend->parent.write = logWrite;
+  backend->parent.exists = logExists;
+  backend->parent.exists_prefix = logExistsPrefix;
+  backend->parent.freshen = logFreshen;
+  backend->parent.foreach = logForeach;
+  backend->parent.free = logFree;
+  backend->store = store.release();
+  return &backend->parent;
+}
+
+} // libgit2pp
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "git2.h"
+
+#include <string>
+
+namespace libgit2pp {
+
+/**
+ Create an object database backend that appends new objects to a log.
+ This is used by Repository::useLogBackend().
+
+ Objects are stored uncompressed in segment files "segment-N.log" in
+ @param dir, each record being a fixed-size header followed by the
+ contents. A segment is sealed once it grows over @param maxSegmentSize
+ and a new one is started. Objects are found through "index", a
+ memory-mapped open-addressing hash table from object ID to segment and
+ offset, which also records how much of the log it covers.
+
+ When the backend is opened, records past the indexed end are checked
+ against their object ID and added to the index. A torn record at the
+ tail, left by a crash, is cut off. With @param syncWrites, every record
+ is synced to the disk before the write returns.
+
+ The backend is thread-safe, but only one backend may use a folder at a
+ time. Throws an exception if the log can't be opened.
+*/
+git_odb_backend* createLogBackend(
+    const std::string& dir,
+    size_t maxSegmentSize,
+    bool syncWrites = false);
+
+} // libgit2pp
@@ -0,0 +1,281 @@
+#include "MaintenanceScheduler.h"
+
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_set>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace libgit2pp {
+
+namespace {
+
+// Length of the name of a loose object file, the SHA without the first
+// two hex digits that make its folder.
+const size_t looseNameSize = GIT_OID_HEXSZ - 2;
+
+// Size of the header of a version 2 pack index.
+const size_t indexHeaderSize = 8;
+// Number of entries of the fan-out table of a pack index.
+const size_t indexFanoutSize = 256;
+
+long long fileSize(const string& path) {
+  struct stat st;
+  return (0 == stat(path.c_str(), &st)) ? st.st_size : 0;
+}
+
+bool hasSuffix(const string& s, const string& suffix) {
+  return s.size() >= suffix.size() &&
+      s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// A folder listing, skipping "." and "..".
+vector<string> listDir(const string& path) {
+  vector<string> ret;
+  DIR* dir = opendir(path.c_str());
+  if (dir == nullptr) {
+    return ret;
+  }
+  while (auto e = readdir(dir)) {
+    string name = e->d_name;
+    if (name != "." && name != "..") {
+      ret.push_back(name);
+    }
+  }
+  closedir(dir);
+  return ret;
+}
+
+// Read the object IDs in the version 2 pack index at @param path.
+bool readPackIndex(const string& path, vector<git_oid>* ids) {
+  ifstream in(path, ios::binary);
+  uint32_t header[2];
+  uint32_t fanout[indexFanoutSize];
+  if (!in.read(reinterpret_cast<char*>(header), sizeof(header)) ||
+      ntohl(header[0]) != 0xff744f63 || ntohl(header[1]) != 2 ||
+      !in.read(reinterpret_cast<char*>(fanout), sizeof(fanout))) {
+    return false;
+  }
+  size_t count = ntohl(fanout[indexFanoutSize - 1]);
+  size_t first = ids->size();
+  ids->resize(first + count);
+  for (size_t i = 0; i < count; ++i) {
+    unsigned char raw[GIT_OID_RAWSZ];
+    if (!in.read(reinterpret_cast<char*>(raw), sizeof(raw))) {
+      ids->resize(first);
+      return false;
+    }
+    git_oid_fromraw(&(*ids)[first + i], raw);
+  }
+  return true;
+}
+
+// Write the objects @param ids to a new pack in @param packDir, whose
+// path without extension is stored in @param base. Returns the size of
+// the pack and its indexes, or -1 on failure.
+long long writePack(
+    git_repository* repo,
+    const string& packDir,
+    const vector<git_oid>& ids,
+    string* base) {
+  git_packbuilder* tmp = nullptr;
+  if (0 != git_packbuilder_new(&tmp, repo)) {
+    return -1;
+  }
+  unique_ptr<git_packbuilder> pb(tmp);
+  for (auto& id : ids) {
+    if (0 != git_packbuilder_insert(pb.get(), &id, nullptr)) {
+      return -1;
+    }
+  }
+  if (0 != git_packbuilder_write(pb.get(), packDir.c_str(), 0, nullptr,
+                                 nullptr)) {
+    return -1;
+  }
+
+  char hex[GIT_OID_HEXSZ + 1];
+  git_oid_tostr(hex, sizeof(hex), git_packbuilder_hash(pb.get()));
+  *base = packDir + "/pack-" + hex;
+  return fileSize(*base + ".pack") + fileSize(*base + ".idx") +
+      fileSize(*base + ".rev");
+}
+
+}
+
+MaintenanceScheduler::MaintenanceScheduler(
+    Repository* repo,
+    size_t maxLooseObjects,
+    size_t maxSmallPacks,
+    size_t smallPackSize,
+    chrono::milliseconds interval)
+  : objectsDir_(string(git_repository_path(repo->get())) + "objects"),
+    maxLooseObjects_(maxLooseObjects),
+    maxSmallPacks_(maxSmallPacks),
+    smallPackSize_(smallPackSize),
+    interval_(interval),
+    repo_(new Repository(git_repository_path(repo->get()))),
+    pending_(0),
+    stop_(false) {
+  thread_ = thread([this] { run(); });
+}
+
+MaintenanceScheduler::~MaintenanceScheduler() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+}
+
+void MaintenanceScheduler::notify(size_t objects) {
+  bool wake;
+  {
+    lock_guard<mutex> lock(mutex_);
+    pending_ += objects;
+    wake = (pending_ >= maxLooseObjects_);
+  }
+  if (wake) {
+    cv_.notify_one();
+  }
+}
+
+MaintenanceReport MaintenanceScheduler::getReport() {
+  lock_guard<mutex> lock(mutex_);
+  return total_;
+}
+
+void MaintenanceScheduler::run() {
+  for (;;) {
+    {
+      unique_lock<mutex> lock(mutex_);
+      cv_.wait_for(lock, interval_, [this] {
+        return stop_ || pending_ >= maxLooseObjects_;
+      });
+      if (stop_) {
+        return;
+      }
+    }
+    try {
+      runOnce();
+    } catch (const exception& ex) {
+      cerr << "Fails to maintain " << objectsDir_ << ": " << ex.what()
+           << endl;
+    }
+  }
+}
+
+MaintenanceReport MaintenanceScheduler::runOnce() {
+  lock_guard<mutex> runLock(runMutex_);
+  auto start = chrono::steady_clock::now();
+  MaintenanceReport report;
+  report.runs = 1;
+  string packDir = objectsDir_ + "/pack";
+
+  // Loose objects written from now on are left for the next run.
+  vector<git_oid> ids;
+  vector<string> files;
+  long long looseBytes = 0;
+  for (auto& dir : listDir(objectsDir_)) {
+    if (dir.size() != 2) {
+      continue;
+    }
+    for (auto& name : listDir(objectsDir_ + "/" + dir)) {
+      git_oid id;
+      if (name.size() != looseNameSize ||
+          0 != git_oid_fromstr(&id, (dir + name).c_str())) {
+        continue;
+      }
+      ids.push_back(id);
+      files.push_back(objectsDir_ + "/" + dir + "/" + name);
+      looseBytes += fileSize(files.back());
+    }
+  }
+  {
+    lock_guard<mutex> lock(mutex_);
+    pending_ = (ids.size() >= maxLooseObjects_) ? 0 : ids.size();
+  }
+
+  if (ids.size() >= maxLooseObjects_) {
+    string base;
+    long long packBytes = writePack(repo_->get(), packDir, ids, &base);
+    if (packBytes < 0) {
+      throw runtime_error("Fails to pack loose objects");
+    }
+    // The objects are in the pack, so readers still find them.
+    for (auto& f : files) {
+      unlink(f.c_str());
+    }
+    report.objectsPacked = ids.size();
+    report.bytesSaved += looseBytes - packBytes;
+  }
+
+  // Small packs, except those to keep.
+  vector<string> packs;
+  long long packsBytes = 0;
+  auto names = listDir(packDir);
+  unordered_set<string> present(names.begin(), names.end());
+  for (auto& name : names) {
+    if (!hasSuffix(name, ".pack")) {
+      continue;
+    }
+    string base = name.substr(0, name.size() - 5);
+    long long size = fileSize(packDir + "/" + name);
+    if (size < (long long) smallPackSize_ && !present.count(base + ".keep") &&
+        present.count(base + ".idx")) {
+      packs.push_back(packDir + "/" + base);
+    }
+  }
+
+  if (packs.size() >= maxSmallPacks_) {
+    ids.clear();
+    vector<string> merged;
+    for (auto& base : packs) {
+      if (readPackIndex(base + ".idx", &ids)) {
+        merged.push_back(base);
+        packsBytes += fileSize(base + ".pack") + fileSize(base + ".idx") +
+            fileSize(base + ".rev");
+      }
+    }
+    string newBase;
+    long long packBytes = writePack(repo_->get(), packDir, ids, &newBase);
+    if (packBytes < 0) {
+      throw runtime_error("Fails to consolidate packs");
+    }
+    // Hide a pack by removing its index first. The new pack has the name
+    // of an old one if it has the same objects.
+    for (auto& base : merged) {
+      if (base == newBase) {
+        packsBytes -= packBytes;
+        packBytes = 0;
+        continue;
+      }
+      unlink((base + ".idx").c_str());
+      unlink((base + ".pack").c_str());
+      unlink((base + ".rev").c_str());
+    }
+    report.packsConsolidated = merged.size();
+    report.bytesSaved += packsBytes - packBytes;
+  }
+
+  report.timeSpent = chrono::duration_cast<chrono::milliseconds>(
+      chrono::steady_clock::now() - start);
+  {
+    lock_guard<mutex> lock(mutex_);
+    total_.runs += report.runs;
+    total_.objectsPacked += report.objectsPacked;
+    total_.packsConsolidated += report.packsConsolidated;
+    total_.bytesSaved += report.bytesSaved;
+    total_.timeSpent += report.timeSpent;
+  }
+  return report;
+}
+
+} // libgit2pp
@@ -0,0 +1,868 @@
+#include "MemoryRefdb.h"
+#include "Wrapper.h"
+#include "git2/sys/refdb_backend.h"
+#include "git2/sys/refs.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <strings.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace libgit2pp {
+
+namespace {
+
+// The value of a reference in the journal when it is deleted.
+const char* deletedValue = "-";
+// Prefix of the value of a symbolic reference in the journal.
+const string symbolicPrefix = "ref:";
+// Separates the fields of a journal line after the name.
+const char fieldSep = '\t';
+
+// Keep @param s on one journal field.
+string journalField(const string& s) {
+  string ret = s;
+  for (auto& c : ret) {
+    if (c == '\n' || c == fieldSep) {
+      c = ' ';
+    }
+  }
+  return ret;
+}
+
+// Split @param s at tabs into at most @param max fields, the last one
+// keeping the rest.
+vector<string> splitFields(const string& s, size_t max) {
+  vector<string> ret;
+  size_t pos = 0;
+  while (ret.size() + 1 < max) {
+    auto sep = s.find(fieldSep, pos);
+    if (sep == string::npos) {
+      break;
+    }
+    ret.push_back(s.substr(pos, sep - pos));
+    pos = sep + 1;
+  }
+  ret.push_back(s.substr(pos));
+  return ret;
+}
+
+struct Ref {
+  bool symbolic;
+  git_oid id;
+  string target;
+};
+
+bool fromReference(const git_reference* ref, Ref* out) {
+  if (git_reference_type(ref) == GIT_REF_SYMBOLIC) {
+    out->symbolic = true;
+    out->target = git_reference_symbolic_target(ref);
+    return true;
+  }
+  auto id = git_reference_target(ref);
+  if (id == nullptr) {
+    return false;
+  }
+  out->symbolic = false;
+  git_oid_cpy(&out->id, id);
+  return true;
+}
+
+git_reference* toReference(const string& name, const Ref& ref) {
+  return ref.symbolic
+      ? git_reference__alloc_symbolic(name.c_str(), ref.target.c_str())
+      : git_reference__alloc(name.c_str(), &ref.id, nullptr);
+}
+
+// Only references in refs/ are listed by the files backend, others such
+// as FETCH_HEAD are looked up in files. HEAD is kept in memory too.
+bool inMemory(const string& name) {
+  return name == "HEAD" || name.compare(0, 5, "refs/") == 0;
+}
+
+class RefStore {
+ public:
+  RefStore(git_repository* repo, git_refdb_backend* fs, size_t batchSize,
+           bool syncWrites);
+  ~RefStore();
+
+  int exists(int* out, const char* name);
+  int lookup(git_reference** out, const char* name);
+  vector<pair<string, Ref>> list(const char* glob);
+  int write(const git_reference* ref, int force, const git_signature* who,
+            const char* message, const git_oid* old, const char* oldTarget);
+  int del(const char* name, const git_oid* old, const char* oldTarget);
+  int rename(git_reference** out, const char* oldName, const char* newName,
+             int force, const git_signature* who, const char* message);
+  int flush();
+  // Reload @param name from files after the files backend changed it.
+  void reload(const string& name);
+
+  // The files backend, used once changes are flushed.
+  git_refdb_backend* const fs_;
+  // Recursive, since the files backend looks up HEAD through this backend
+  // while writing.
+  recursive_mutex mutex_;
+  unordered_map<void*, string> locks_;
+  bool syncWrites_;
+
+ private:
+  struct LogEntry {
+    git_oid id;
+    unique_ptr<git_signature> who;
+    string message;
+  };
+
+  struct Pending {
+    // Whether the reference was deleted since the last flush.
+    bool deleted = false;
+    // The reflog entries of the updates, oldest first.
+    vector<LogEntry> entries;
+    // Whether the entries are in the reflog of the reference already.
+    bool logged = false;
+  };
+
+  git_repository* const repo_;
+  const size_t batchSize_;
+  const string journalPath_;
+  int journal_;
+  // Signs updates that come without a signature.
+  unique_ptr<git_signature> who_;
+
+  map<string, Ref> refs_;
+  // References changed since the last flush.
+  map<string, Pending> dirty_;
+  size_t updates_;
+  bool flushing_;
+  // Whether the updates being written come from the journal.
+  bool replaying_;
+
+  int check(const string& name, const git_oid* old, const char* oldTarget);
+  bool update(const string& name, const Ref* ref, const git_signature* who,
+              const char* message);
+  int logAllRefUpdates();
+  bool shouldLog(int logAll, const string& name);
+  int writeRef(const string& name, const Ref& ref);
+  int appendLog(const string& name, const vector<LogEntry>& entries);
+  int flushLocked();
+  void replay();
+};
+
+RefStore::RefStore(
+    git_repository* repo,
+    git_refdb_backend* fs,
+    size_t batchSize,
+    bool syncWrites)
+  : fs_(fs),
+    syncWrites_(syncWrites),
+    repo_(repo),
+    batchSize_(batchSize > 0 ? batchSize : 1),
+    journalPath_(string(git_repository_path(repo)) + "refs.journal"),
+    journal_(-1),
+    updates_(0),
+    flushing_(false),
+    replaying_(false) {
+  // Load every reference through the files backend.
+  git_reference_iterator* it = nullptr;
+  if (0 != git_reference_iterator_new(&it, repo)) {
+    throw runtime_error("Fails to list references");
+  }
+  git_reference* ref = nullptr;
+  while (0 == git_reference_next(&ref, it)) {
+    Ref r;
+    if (fromReference(ref, &r)) {
+      refs_[git_reference_name(ref)] = r;
+    }
+    git_reference_free(ref);
+  }
+  git_reference_iterator_free(it);
+  if (0 == git_reference_lookup(&ref, repo, "HEAD")) {
+    Ref r;
+    if (fromReference(ref, &r)) {
+      refs_["HEAD"] = r;
+    }
+    git_reference_free(ref);
+  }
+
+  git_signature* who = nullptr;
+  if (0 != git_signature_default(&who, repo) &&
+      0 != git_signature_now(&who, "libgit2pp", "libgit2pp@localhost")) {
+    throw runtime_error("Fails to create a signature");
+  }
+  who_.reset(who);
+  replay();
+
+  journal_ = open(journalPath_.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (journal_ < 0) {
+    throw runtime_error("Fails to open " + journalPath_);
+  }
+}
+
+RefStore::~RefStore() {
+  if (journal_ >= 0) {
+    close(journal_);
+  }
+}
+
+void RefStore::replay() {
+  ifstream in(journalPath_);
+  string line;
+  size_t count = 0;
+  // A line cut by a crash has no end of line, and is ignored.
+  while (getline(in, line) && !in.eof()) {
+    auto sep = line.find(' ');
+    if (sep == string::npos) {
+      continue;
+    }
+    string value = line.substr(0, sep);
+    // The name, then the signature and message of the update, if any.
+    auto fields = splitFields(line.substr(sep + 1), 6);
+    string name = fields[0];
+    unique_ptr<git_signature> who;
+    string message = "replayed from journal";
+    if (fields.size() == 6) {
+      git_signature* tmp = nullptr;
+      if (0 == git_signature_new(&tmp, fields[3].c_str(), fields[4].c_str(),
+                                 strtoll(fields[1].c_str(), nullptr, 10),
+                                 atoi(fields[2].c_str()))) {
+        who.reset(tmp);
+      }
+      message = fields[5];
+    }
+    Ref r;
+    bool ok;
+    if (value == deletedValue) {
+      ok = update(name, nullptr, nullptr, nullptr);
+    } else if (value.compare(0, symbolicPrefix.size(), symbolicPrefix) == 0) {
+      r.symbolic = true;
+      r.target = value.substr(symbolicPrefix.size());
+      ok = update(name, &r, who.get(), message.c_str());
+    } else if (0 == git_oid_fromstr(&r.id, value.c_str())) {
+      r.symbolic = false;
+      ok = update(name, &r, who.get(), message.c_str());
+    } else {
+      continue;
+    }
+    count += ok;
+  }
+  if (count > 0) {
+    cerr << "Replays " << count << " reference updates" << endl;
+  }
+  replaying_ = true;
+  int ret = flushLocked();
+  replaying_ = false;
+  if (ret != 0) {
+    throw runtime_error("Fails to write replayed references");
+  }
+}
+
+int RefStore::check(
+    const string& name,
+    const git_oid* old,
+    const char* oldTarget) {
+  auto it = refs_.find(name);
+  if (old && (it == refs_.end() || it->second.symbolic ||
+              !git_oid_equal(old, &it->second.id))) {
+    return GIT_EMODIFIED;
+  }
+  if (oldTarget && (it == refs_.end() || !it->second.symbolic ||
+                    it->second.target != oldTarget)) {
+    return GIT_EMODIFIED;
+  }
+  return 0;
+}
+
+bool RefStore::update(
+    const string& name,
+    const Ref* ref,
+    const git_signature* who,
+    const char* message) {
+  if (who == nullptr) {
+    who = who_.get();
+  }
+  string msg = journalField(message ? message : "");
+
+  // Journal the update before it is visible to anyone. Replayed updates
+  // are already in the journal, which is not open yet.
+  if (journal_ >= 0) {
+    string line;
+    if (ref == nullptr) {
+      line = deletedValue;
+    } else if (ref->symbolic) {
+      line = symbolicPrefix + ref->target;
+    } else {
+      char hex[GIT_OID_HEXSZ + 1];
+      git_oid_tostr(hex, sizeof(hex), &ref->id);
+      line = hex;
+    }
+    line += " " + name;
+    if (ref) {
+      line += fieldSep + to_string(who->when.time) +
+          fieldSep + to_string(who->when.offset) +
+          fieldSep + journalField(who->name) +
+          fieldSep + journalField(who->email) +
+          fieldSep + msg;
+    }
+    line += "\n";
+    off_t end = lseek(journal_, 0, SEEK_END);
+    if ((ssize_t) line.size() != ::write(journal_, line.data(), line.size()) ||
+        (syncWrites_ && 0 != fdatasync(journal_))) {
+      cerr << "Fails to journal " << name << endl;
+      // Drop what may have been written, so a replay doesn't apply it.
+      if (end >= 0) {
+        ftruncate(journal_, end);
+      }
+      return false;
+    }
+  }
+
+  auto& p = dirty_[name];
+  if (ref == nullptr) {
+    refs_.erase(name);
+    // The reflog goes with the reference.
+    p.deleted = true;
+    p.entries.clear();
+    p.logged = false;
+  } else {
+    refs_[name] = *ref;
+    // As in git, a symbolic reference to an unborn branch isn't logged.
+    const Ref* target = ref;
+    if (ref->symbolic) {
+      auto it = refs_.find(ref->target);
+      target = (it != refs_.end() && !it->second.symbolic)
+          ? &it->second : nullptr;
+    }
+    if (target) {
+      LogEntry e;
+      git_oid_cpy(&e.id, &target->id);
+      git_signature* dup = nullptr;
+      git_signature_dup(&dup, who);
+      e.who.reset(dup);
+      e.message = msg;
+      p.entries.push_back(move(e));
+    }
+  }
+  ++updates_;
+  return true;
+}
+
+int RefStore::exists(int* out, const char* name) {
+  lock_guard<recursive_mutex> lock(mutex_);
+  if (!inMemory(name)) {
+    return fs_->exists(out, fs_, name);
+  }
+  *out = refs_.count(name) ? 1 : 0;
+  return 0;
+}
+
+int RefStore::lookup(git_reference** out, const char* name) {
+  lock_guard<recursive_mutex> lock(mutex_);
+  if (!inMemory(name)) {
+    return fs_->lookup(out, fs_, name);
+  }
+  auto it = refs_.find(name);
+  if (it == refs_.end()) {
+    return GIT_ENOTFOUND;
+  }
+  *out = toReference(it->first, it->second);
+  return *out ? 0 : GIT_ERROR;
+}
+
+vector<pair<string, Ref>> RefStore::list(const char* glob) {
+  lock_guard<recursive_mutex> lock(mutex_);
+  vector<pair<string, Ref>> ret;
+  // As in files, "*" matches "/" too.
+  for (auto& p : refs_) {
+    if (p.first != "HEAD" &&
+        (glob == nullptr || 0 == fnmatch(glob, p.first.c_str(), 0))) {
+      ret.push_back(p);
+    }
+  }
+  return ret;
+}
+
+int RefStore::write(
+    const git_reference* ref,
+    int force,
+    const git_signature* who,
+    const char* message,
+    const git_oid* old,
+    const char* oldTarget) {
+  lock_guard<recursive_mutex> lock(mutex_);
+  string name = git_reference_name(ref);
+  if (!inMemory(name)) {
+    return fs_->write(fs_, ref, force, who, message, old, oldTarget);
+  }
+  if (!force && refs_.count(name)) {
+    return GIT_EEXISTS;
+  }
+  int ret = check(name, old, oldTarget);
+  if (ret != 0) {
+    return ret;
+  }
+  Ref r;
+  if (!fromReference(ref, &r)) {
+    return GIT_ERROR;
+  }
+  if (!update(name, &r, who, message)) {
+    return GIT_ERROR;
+  }
+  // The update is journaled, so it is done even if the flush fails. The
+  // failure is reported by the next flush.
+  if (updates_ >= batchSize_) {
+    flushLocked();
+  }
+  return 0;
+}
+
+int RefStore::del(const char* name, const git_oid* old, const char* oldTarget) {
+  lock_guard<recursive_mutex> lock(mutex_);
+  if (!inMemory(name)) {
+    return fs_->del(fs_, name, old, oldTarget);
+  }
+  if (!refs_.count(name)) {
+    return GIT_ENOTFOUND;
+  }
+  int ret = check(name, old, oldTarget);
+  if (ret != 0) {
+    return ret;
+  }
+  if (!update(name, nullptr, nullptr, nullptr)) {
+    return GIT_ERROR;
+  }
+  if (updates_ >= batchSize_) {
+    flushLocked();
+  }
+  return 0;
+}
+
+int RefStore::rename(
+    git_reference** out,
+    const char* oldName,
+    const char* newName,
+    int force,
+    const git_signature* who,
+    const char* message) {
+  // Renames move reflogs too, so they go through files right away.
+  lock_guard<recursive_mutex> lock(mutex_);
+  int ret = flushLocked();
+  if (ret == 0) {
+    ret = fs_->rename(out, fs_, oldName, newName, force, who, message);
+  }
+  if (ret == 0) {
+    Ref r;
+    refs_.erase(oldName);
+    if (fromReference(*out, &r)) {
+      refs_[newName] = r;
+    }
+  }
+  return ret;
+}
+
+int RefStore::flush() {
+  lock_guard<recursive_mutex> lock(mutex_);
+  return flushLocked();
+}
+
+int RefStore::logAllRefUpdates() {
+  // Unset means logging unless the repository is bare, as in git.
+  int ret = !git_repository_is_bare(repo_);
+  git_config* cfg = nullptr;
+  if (0 == git_repository_config_snapshot(&cfg, repo_)) {
+    const char* value = nullptr;
+    int on = 0;
+    if (0 == git_config_get_string(&value, cfg, "core.logAllRefUpdates")) {
+      ret = (0 == strcasecmp(value, "always"))
+          ? 2 : (0 == git_config_parse_bool(&on, value) && on);
+    }
+    git_config_free(cfg);
+  }
+  return ret;
+}
+
+// Whether the files backend would log the updates of @param name, given
+// core.logAllRefUpdates @param logAll.
+bool RefStore::shouldLog(int logAll, const string& name) {
+  if (logAll != 1) {
+    return logAll == 2;
+  }
+  return name == "HEAD" ||
+      name.compare(0, 11, "refs/heads/") == 0 ||
+      name.compare(0, 13, "refs/remotes/") == 0 ||
+      name.compare(0, 11, "refs/notes/") == 0 ||
+      fs_->has_log(fs_, name.c_str()) == 1;
+}
+
+int RefStore::writeRef(const string& name, const Ref& ref) {
+  // Written through a lock, so that files adds no reflog entry of its own.
+  unique_ptr<git_reference> r(toReference(name, ref));
+  if (r.get() == nullptr) {
+    return GIT_ERROR;
+  }
+  void* payload = nullptr;
+  int ret = fs_->lock(&payload, fs_, name.c_str());
+  if (ret == 0) {
+    ret = fs_->unlock(fs_, payload, 1, 0, r.get(), nullptr, nullptr);
+  }
+  return ret;
+}
+
+int RefStore::appendLog(const string& name, const vector<LogEntry>& entries) {
+  // Read, append and write the reflog through files directly, since the
+  // repository may be going away when the backend is freed.
+  git_reflog* log = nullptr;
+  int ret = fs_->ensure_log(fs_, name.c_str());
+  if (ret == 0) {
+    ret = fs_->reflog_read(&log, fs_, name.c_str());
+  }
+  // A flush that failed partway leaves the journal with updates some
+  // reflogs have already. A reflog is written whole, so those are its
+  // newest entries, and the updates up to its newest entry are skipped.
+  size_t first = 0;
+  if (ret == 0 && replaying_ && git_reflog_entrycount(log) > 0) {
+    auto newest = git_reflog_entry_byindex(log, 0);
+    auto who = git_reflog_entry_committer(newest);
+    auto message = git_reflog_entry_message(newest);
+    for (size_t i = entries.size(); i-- > 0;) {
+      auto& e = entries[i];
+      if (git_oid_equal(&e.id, git_reflog_entry_id_new(newest)) &&
+          e.who->when.time == who->when.time &&
+          e.message == (message ? message : "")) {
+        first = i + 1;
+        break;
+      }
+    }
+  }
+  for (size_t i = first; i < entries.size() && ret == 0; ++i) {
+    auto& e = entries[i];
+    ret = git_reflog_append(log, &e.id, e.who.get(), e.message.c_str());
+  }
+  if (ret == 0) {
+    ret = fs_->reflog_write(fs_, log);
+  }
+  git_reflog_free(log);
+  return ret;
+}
+
+int RefStore::flushLocked() {
+  // The files backend may call back into this backend while writing.
+  if (flushing_) {
+    return 0;
+  }
+  flushing_ = true;
+  int ret = 0;
+  int logAll = dirty_.empty() ? 0 : logAllRefUpdates();
+  auto head = refs_.find("HEAD");
+  for (auto it = dirty_.begin(); it != dirty_.end();) {
+    auto& name = it->first;
+    auto& p = it->second;
+    auto ref = refs_.find(name);
+    if (p.deleted) {
+      ret = fs_->del(fs_, name.c_str(), nullptr, nullptr);
+      if (ret == GIT_ENOTFOUND) {
+        ret = 0;
+      }
+      if (ret == 0) {
+        p.deleted = false;
+      }
+    }
+    if (ret == 0 && ref != refs_.end()) {
+      ret = writeRef(name, ref->second);
+    }
+    // One reflog entry per update, and HEAD logs the branch it is on.
+    if (ret == 0 && ref != refs_.end() && !p.entries.empty() &&
+        shouldLog(logAll, name)) {
+      if (!p.logged) {
+        ret = appendLog(name, p.entries);
+        p.logged = (ret == 0);
+      }
+      if (ret == 0 && head != refs_.end() && name != "HEAD" &&
+          head->second.symbolic && head->second.target == name) {
+        ret = appendLog("HEAD", p.entries);
+      }
+    }
+    if (ret != 0) {
+      cerr << "Fails to write reference " << name << endl;
+      break;
+    }
+    it = dirty_.erase(it);
+  }
+  // The journal is kept until every reference is written.
+  if (ret == 0) {
+    updates_ = 0;
+    if (journal_ >= 0 && 0 != ftruncate(journal_, 0)) {
+      ret = GIT_ERROR;
+    }
+  }
+  flushing_ = false;
+  return ret;
+}
+
+void RefStore::reload(const string& name) {
+  lock_guard<recursive_mutex> lock(mutex_);
+  git_reference* out = nullptr;
+  Ref r;
+  if (0 == fs_->lookup(&out, fs_, name.c_str()) && fromReference(out, &r)) {
+    refs_[name] = r;
+  } else {
+    refs_.erase(name);
+  }
+  git_reference_free(out);
+}
+
+// The backend handed to libgit2. It only forwards to the store.
+struct MemoryRefdb {
+  git_refdb_backend parent;
+  RefStore* store;
+};
+
+RefStore* storeOf(git_refdb_backend* backend) {
+  return reinterpret_cast<MemoryRefdb*>(backend)->store;
+}
+
+// Iterates over a snapshot of the references.
+struct MemoryIterator {
+  git_reference_iterator parent;
+  vector<pair<string, Ref>>* refs;
+  size_t pos;
+};
+
+int iteratorNext(git_reference** out, git_reference_iterator* iter) {
+  auto it = reinterpret_cast<MemoryIterator*>(iter);
+  if (it->pos >= it->refs->size()) {
+    return GIT_ITEROVER;
+  }
+  auto& p = (*it->refs)[it->pos++];
+  *out = toReference(p.first, p.second);
+  return *out ? 0 : GIT_ERROR;
+}
+
+int iteratorNextName(const char** out, git_reference_iterator* iter) {
+  auto it = reinterpret_cast<MemoryIterator*>(iter);
+  if (it->pos >= it->refs->size()) {
+    return GIT_ITEROVER;
+  }
+  *out = (*it->refs)[it->pos++].first.c_str();
+  return 0;
+}
+
+void iteratorFree(git_reference_iterator* iter) {
+  auto it = reinterpret_cast<MemoryIterator*>(iter);
+  delete it->refs;
+  delete it;
+}
+
+int refdbExists(int* out, git_refdb_backend* backend, const char* name) {
+  return storeOf(backend)->exists(out, name);
+}
+
+int refdbLookup(
+    git_reference** out,
+    git_refdb_backend* backend,
+    const char* name) {
+  return storeOf(backend)->lookup(out, name);
+}
+
+int refdbIterator(
+    git_reference_iterator** out,
+    git_refdb_backend* backend,
+    const char* glob) {
+  auto it = new MemoryIterator();
+  it->refs = new vector<pair<string, Ref>>(storeOf(backend)->list(glob));
+  it->pos = 0;
+  it->parent.next = iteratorNext;
+  it->parent.next_name = iteratorNextName;
+  it->parent.free = iteratorFree;
+  *out = &it->parent;
+  return 0;
+}
+
+int refdbWrite(
+    git_refdb_backend* backend,
+    const git_reference* ref,
+    int force,
+    const git_signature* who,
+    const char* message,
+    const git_oid* old,
+    const char* oldTarget) {
+  return storeOf(backend)->write(ref, force, who, message, old, oldTarget);
+}
+
+int refdbRename(
+    git_reference** out,
+    git_refdb_backend* backend,
+    const char* oldName,
+    const char* newName,
+    int force,
+    const git_signature* who,
+    const char* message) {
+  return storeOf(backend)->rename(out, oldName, newName, force, who, message);
+}
+
+int refdbDel(
+    git_refdb_backend* backend,
+    const char* name,
+    const git_oid* old,
+    const char* oldTarget) {
+  return storeOf(backend)->del(name, old, oldTarget);
+}
+
+// Reflogs and packing are left to the files backend, once the changes in
+// memory are written.
+int refdbCompress(git_refdb_backend* backend) {
+  auto s = storeOf(backend);
+  int ret = s->flush();
+  return ret != 0 ? ret : s->fs_->compress(s->fs_);
+}
+
+// Asked by the files backend while it writes a reference, so these don't
+// flush.
+int refdbHasLog(git_refdb_backend* backend, const char* name) {
+  auto s = storeOf(backend);
+  return s->fs_->has_log(s->fs_, name);
+}
+
+int refdbEnsureLog(git_refdb_backend* backend, const char* name) {
+  auto s = storeOf(backend);
+  return s->fs_->ensure_log(s->fs_, name);
+}
+
+int refdbReflogRead(
+    git_reflog** out,
+    git_refdb_backend* backend,
+    const char* name) {
+  auto s = storeOf(backend);
+  int ret = s->flush();
+  return ret != 0 ? ret : s->fs_->reflog_read(out, s->fs_, name);
+}
+
+int refdbReflogWrite(git_refdb_backend* backend, git_reflog* reflog) {
+  auto s = storeOf(backend);
+  int ret = s->flush();
+  return ret != 0 ? ret : s->fs_->reflog_write(s->fs_, reflog);
+}
+
+int refdbReflogRename(
+    git_refdb_backend* backend,
+    const char* oldName,
+    const char* newName) {
+  auto s = storeOf(backend);
+  int ret = s->flush();
+  return ret != 0 ? ret : s->fs_->reflog_rename(s->fs_, oldName, newName);
+}
+
+int refdbReflogDelete(git_refdb_backend* backend, const char* name) {
+  auto s = storeOf(backend);
+  int ret = s->flush();
+  return ret != 0 ? ret : s->fs_->reflog_delete(s->fs_, name);
+}
+
+// Transactions lock references in files, so pending changes are written
+// first, and the locked references are read back once unlocked.
+int refdbLock(void** payload, git_refdb_backend* backend, const char* name) {
+  auto s = storeOf(backend);
+  int ret = s->flush();
+  if (ret == 0) {
+    ret = s->fs_->lock(payload, s->fs_, name);
+  }
+  if (ret == 0) {
+    lock_guard<recursive_mutex> lock(s->mutex_);
+    s->locks_[*payload] = name;
+  }
+  return ret;
+}
+
+int refdbUnlock(
+    git_refdb_backend* backend,
+    void* payload,
+    int success,
+    int updateReflog,
+    const git_reference* ref,
+    const git_signature* who,
+    const char* message) {
+  auto s = storeOf(backend);
+  string name;
+  {
+    lock_guard<recursive_mutex> lock(s->mutex_);
+    name = s->locks_[payload];
+    s->locks_.erase(payload);
+  }
+  int ret = s->fs_->unlock(s->fs_, payload, success, updateReflog, ref, who,
+                           message);
+  s->reload(name);
+  return ret;
+}
+
+void refdbFree(git_refdb_backend* backend) {
+  auto s = storeOf(backend);
+  s->flush();
+  auto fs = s->fs_;
+  delete s;
+  fs->free(fs);
+  delete reinterpret_cast<MemoryRefdb*>(backend);
+}
+
+}
+
+git_refdb_backend* createMemoryRefdb(
+    git_repository* repo,
+    size_t batchSize,
+    bool syncWrites) {
+  git_refdb_backend* fs = nullptr;
+  if (0 != git_refdb_backend_fs(&fs, repo)) {
+    return nullptr;
+  }
+  RefStore* store = nullptr;
+  try {
+    store = new RefStore(repo, fs, batchSize, syncWrites);
+  } catch (const exception& ex) {
+    cerr << ex.what() << endl;
+    fs->free(fs);
+    return nullptr;
+  }
+
+  auto b = new MemoryRefdb();
+  git_refdb_init_backend(&b->parent, GIT_REFDB_BACKEND_VERSION);
+  b->parent.exists = refdbExists;
+  b->parent.lookup = refdbLookup;
+  b->parent.iterator = refdbIterator;
+  b->parent.write = refdbWrite;
+  b->parent.rename = refdbRename;
+  b->parent.del = refdbDel;
+  b->parent.compress = refdbCompress;
+  b->parent.has_log = refdbHasLog;
+  b->parent.ensure_log = refdbEnsureLog;
+  b->parent.free = refdbFree;
+  b->parent.reflog_read = refdbReflogRead;
+  b->parent.reflog_write = refdbReflogWrite;
+  b->parent.reflog_rename = refdbReflogRename;
+  b->parent.reflog_delete = refdbReflogDelete;
+  b->parent.lock = refdbLock;
+  b->parent.unlock = refdbUnlock;
+  b->store = store;
+  return &b->parent;
+}
+
+int flushMemoryRefdb(git_refdb_backend* backend) {
+  return storeOf(backend)->flush();
+}
+
+void setMemoryRefdbSync(git_refdb_backend* backend, bool syncWrites) {
+  auto s = storeOf(backend);
+  lock_guard<recursive_mutex> lock(s->mutex_);
+  s->syncWrites_ = syncWrites;
+}
+
+} // libgit2pp
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "git2.h"
+
+namespace libgit2pp {
+
+/**
+ Create a reference database backend that keeps references in memory.
+ This is used by Repository::useMemoryRefdb().
+
+ References are loaded from the files backend of @param repo. Updates
+ are checked against the expected old values, appended to the journal
+ "refs.journal" in the repository folder with their signature and
+ message, and then applied in memory. After @param batchSize updates, or
+ when flushed, changed references are written with the files backend,
+ each update gets its own reflog entry, and the journal is emptied. With
+ @param syncWrites, each journal entry is synced to the disk before the
+ update returns.
+
+ When the backend is opened, updates left in the journal by a crash are
+ replayed and written. Only one backend may use a repository at a time.
+ Returns nullptr on failure.
+*/
+git_refdb_backend* createMemoryRefdb(
+    git_repository* repo,
+    size_t batchSize,
+    bool syncWrites = false);
+
+// Write the references changed since the last flush of @param backend,
+// which was created by createMemoryRefdb(). Returns 0 on success.
+int flushMemoryRefdb(git_refdb_backend* backend);
+
+// Set whether @param backend syncs each journal entry.
+void setMemoryRefdbSync(git_refdb_backend* backend, bool syncWrites);
+
+} // libgit2pp
@@ -0,0 +1,28 @@
+#include "OidSet.h"
+
+using namespace std;
+
+namespace libgit2pp {
+
+OidSet::OidSet(size_t capacity) : capacity_(capacity) {
+}
+
+bool OidSet::contains(const git_oid* id) {
+  lock_guard<mutex> lock(mutex_);
+  return ids_.count(*id) > 0;
+}
+
+void OidSet::insert(const git_oid* id) {
+  lock_guard<mutex> lock(mutex_);
+  if (ids_.size() >= capacity_) {
+    ids_.clear();
+  }
+  ids_.insert(*id);
+}
+
+void OidSet::clear() {
+  lock_guard<mutex> lock(mutex_);
+  ids_.clear();
+}
+
+} // libgit2pp
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "git2.h"
+
+#include <cstring>
+#include <mutex>
+#include <unordered_set>
+
+namespace libgit2pp {
+
+/**
+ A bounded, thread-safe set of object IDs. This class is used by
+ Repository to remember objects that are known to be in the object
+ database. Once the set grows over its capacity it starts over, so it
+ only ever saves lookups and never has to be exact.
+*/
+class OidSet {
+ public:
+  // @param capacity the maximum number of object IDs kept.
+  explicit OidSet(size_t capacity);
+
+  bool contains(const git_oid* id);
+
+  void insert(const git_oid* id);
+
+  void clear();
+
+ private:
+  struct Hash {
+    size_t operator()(const git_oid& id) const {
+      // Object IDs are uniformly distributed already.
+      size_t h;
+      memcpy(&h, id.id, sizeof(h));
+      return h;
+    }
+  };
+
+  struct Equal {
+    bool operator()(const git_oid& a, const git_oid& b) const {
+      return 0 == git_oid_cmp(&a, &b);
+    }
+  };
+
+  const size_t capacity_;
+  std::mutex mutex_;
+  std::unordered_set<git_oid, Hash, Equal> ids_;
+};
+
+} // libgit2pp
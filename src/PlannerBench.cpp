@@ -0,0 +1,162 @@
+#include "ChangeSet.h"
+#include "DiffGenerator.h"
+#include "Wrapper.h"
+#include "TestUtils.h"
+
+#include <chrono>
+#include <map>
+#include <sstream>
+#include <iostream>
+
+using namespace libgit2pp;
+using namespace std;
+using namespace std::chrono;
+
+// Shape of the change sets, see LoadTest.
+const int avgFileSize = 16;
+const int avgFileNumber = 16;
+const int avgOverlappingFileNumber = 1;
+const int avgDirDepth = 4;
+const int topDirFanout = 500;
+const int middleDirFanout = 5;
+const int leafDirFanout = 50;
+const int changeSetSize = 10000;
+const int rounds = 20;
+
+const string root("/tmp/PlannerBench");
+
+string joinFilePath(const vector<string>& parts, int start, int end) {
+  stringstream ss;
+  for (int i = start; i < end; ++i) {
+    ss << parts[i];
+    if (i < end - 1) {
+      ss << "/";
+    }
+  }
+  return ss.str();
+}
+
+// The planner createTreeUsingGitTree used before ChangeSet, kept here as
+// the baseline: a map of every prefix built with splitFilePath and
+// joinFilePath.
+size_t planWithPrefixMap(
+    const unordered_map<string, git_oid*>& addedFiles,
+    const unordered_set<string>& deletedFiles) {
+  vector<string> affectedFiles;
+  for (auto& p : addedFiles) {
+    affectedFiles.push_back(p.first);
+  }
+  for (auto& s : deletedFiles) {
+    affectedFiles.push_back(s);
+  }
+
+  map<string, pair<vector<string>, int>> changeTreeMap;
+  for (auto& s : affectedFiles) {
+    vector<string> parts = splitFilePath(s);
+    string name = parts.back();
+    parts.pop_back();
+    for (int i = parts.size(); i >= 0; --i) {
+      auto prefix = joinFilePath(parts, 0, i);
+      if (i == parts.size()) {
+        changeTreeMap[prefix].first.push_back(name);
+        changeTreeMap[prefix].second = -1;
+      } else if (changeTreeMap.count(prefix) == 0) {
+        changeTreeMap[prefix] = make_pair(vector<string>(), -1);
+      } else {
+        break;
+      }
+    }
+  }
+  return changeTreeMap.size();
+}
+
+main() {
+  Git2 git2;
+  setupRoot(root);
+
+  DiffGenerator gen(
+      avgFileSize,
+      avgFileNumber,
+      avgOverlappingFileNumber,
+      avgDirDepth,
+      topDirFanout,
+      middleDirFanout,
+      leafDirFanout,
+      changeSetSize);
+
+  // Accumulate diffs into one large change set.
+  unordered_map<string, string> diff;
+  while (diff.size() < changeSetSize && gen.next(&diff)) {
+  }
+
+  unique_ptr<Repository> r;
+  try {
+    r = make_unique<Repository>(root, true);
+  } catch (const exception& ex) {
+    throw runtime_error("Fails to create a new git repository");
+  }
+
+  vector<git_oid> oids(diff.size());
+  unordered_map<string, git_oid*> addedFiles;
+  {
+    int idx = 0;
+    for (auto& p : diff) {
+      addedFiles[p.first] = &oids[idx];
+      if (!r->createBlobFromBuffer(p.second, &oids[idx++])) {
+        throw runtime_error("Fails to create an object in git");
+      }
+    }
+  }
+  unordered_set<string> deletedFiles;
+
+  // Planning only.
+  {
+    int64_t elaps = 0;
+    size_t dirs = 0;
+    for (int i = 0; i < rounds; ++i) {
+      auto start = steady_clock::now();
+      dirs = planWithPrefixMap(addedFiles, deletedFiles);
+      auto end = steady_clock::now();
+      elaps += duration_cast<microseconds>(end - start).count();
+    }
+    cerr << "Prefix map planner: " << addedFiles.size() << " files, "
+         << dirs << " directories, avg " << elaps / rounds << " us" << endl;
+  }
+  {
+    int64_t elaps = 0;
+    ChangeSet changes;
+    for (int i = 0; i < rounds; ++i) {
+      auto start = steady_clock::now();
+      if (!changes.build(addedFiles, deletedFiles)) {
+        throw runtime_error("Fails to build the change set");
+      }
+      auto end = steady_clock::now();
+      elaps += duration_cast<microseconds>(end - start).count();
+    }
+    cerr << "ChangeSet planner: " << changes.fileCount() << " files, avg "
+         << elaps / rounds << " us" << endl;
+  }
+
+  // Planning and writing the trees on top of the previous round's tree,
+  // without and with the tree cache.
+  for (size_t cacheSize : {0, 1024 * 16}) {
+    r->setTreeCacheSize(cacheSize);
+    int64_t elaps = 0;
+    string source;
+    for (int i = 0; i < rounds; ++i) {
+      git_oid id;
+      auto start = steady_clock::now();
+      if (!r->createTreeUsingExistingTree(&id, source, addedFiles,
+                                          deletedFiles)) {
+        throw runtime_error("Fails to create a tree");
+      }
+      auto end = steady_clock::now();
+      elaps += duration_cast<microseconds>(end - start).count();
+
+      source.resize(GIT_OID_HEXSZ);
+      git_oid_nfmt(const_cast<char*>(source.data()), source.size(), &id);
+    }
+    cerr << "Tree creation with tree cache size " << cacheSize << ": avg "
+         << elaps / rounds << " us" << endl;
+  }
+}
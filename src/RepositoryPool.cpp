@@ -0,0 +1,79 @@
+#include "RepositoryPool.h"
+#include "git2/sys/repository.h"
+
+#include <stdexcept>
+
+using namespace std;
+
+namespace libgit2pp {
+
+// The path is the repository itself, so don't look for one in parent
+// folders or a .git folder below it.
+const unsigned int openFlags = GIT_REPOSITORY_OPEN_NO_SEARCH
+                             | GIT_REPOSITORY_OPEN_NO_DOTGIT
+                             | GIT_REPOSITORY_OPEN_BARE;
+
+RepositoryPool::RepositoryPool(const string& path, size_t maxIdle)
+    : path_(path), maxIdle_(maxIdle), odb_(nullptr) {
+  git_repository* repo = nullptr;
+  if (0 != git_repository_open_ext(&repo, path_.c_str(), openFlags,
+                                   nullptr)) {
+    throw runtime_error("Fails to open a repository");
+  }
+  owner_.reset(new Repository(repo));
+  if (0 != git_repository_odb(&odb_, repo)) {
+    throw runtime_error("Fails to open the object database");
+  }
+  idle_.push_back(open());
+}
+
+RepositoryPool::~RepositoryPool() {
+  // Handles must be freed before the object database they share.
+  idle_.clear();
+  owner_.reset();
+  git_odb_free(odb_);
+}
+
+RepositoryPool::Handle RepositoryPool::checkout() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    if (!idle_.empty()) {
+      unique_ptr<Repository> repo(std::move(idle_.back()));
+      idle_.pop_back();
+      return Handle(this, std::move(repo));
+    }
+  }
+  return Handle(this, open());
+}
+
+size_t RepositoryPool::size() {
+  lock_guard<mutex> lock(mutex_);
+  return idle_.size();
+}
+
+unique_ptr<Repository> RepositoryPool::open() {
+  git_repository* repo = nullptr;
+  if (0 != git_repository_open_ext(&repo, path_.c_str(), openFlags,
+                                   nullptr)) {
+    throw runtime_error("Fails to open a repository");
+  }
+  unique_ptr<Repository> ret(new Repository(repo));
+  lock_guard<mutex> lock(mutex_);
+  if (0 != git_repository_set_odb(repo, odb_) ||
+      0 != git_repository_set_odb(owner_->get(), odb_)) {
+    throw runtime_error("Fails to set the object database");
+  }
+  return ret;
+}
+
+void RepositoryPool::checkin(unique_ptr<Repository> repo) {
+  lock_guard<mutex> lock(mutex_);
+  if (idle_.size() < maxIdle_) {
+    idle_.push_back(std::move(repo));
+    return;
+  }
+  repo.reset();
+  git_repository_set_odb(owner_->get(), odb_);
+}
+
+} // libgit2pp
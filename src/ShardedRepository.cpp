@@ -0,0 +1,270 @@
+#include "ShardedRepository.h"
+#include "git2/sys/commit.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <future>
+#include <iostream>
+#include <stdexcept>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace libgit2pp {
+
+namespace {
+
+string shardName(size_t i) {
+  char name[32];
+  snprintf(name, sizeof(name), "shard-%03zu", i);
+  return name;
+}
+
+// Count the shard folders in @param path.
+size_t countShards(const string& path) {
+  size_t ret = 0;
+  if (DIR* dir = opendir(path.c_str())) {
+    while (auto e = readdir(dir)) {
+      ret += (0 == string(e->d_name).compare(0, 6, "shard-"));
+    }
+    closedir(dir);
+  }
+  return ret;
+}
+
+}
+
+size_t routeByTopDirectory(const string& path, size_t shards) {
+  // FNV-1a, as the shard of a path must not change between builds like
+  // std::hash may.
+  uint64_t hash = 14695981039346656037ULL;
+  for (char c : path.substr(0, path.find('/'))) {
+    hash = (hash ^ (unsigned char) c) * 1099511628211ULL;
+  }
+  return hash % shards;
+}
+
+ShardedRepository::ShardedRepository(
+    const string& path,
+    size_t shards,
+    ShardRouter router,
+    size_t threads)
+    : router_(router) {
+  if (shards == 0) {
+    throw runtime_error("Expect at least one shard");
+  }
+  size_t existing = countShards(path);
+  if (existing != 0 && existing != shards) {
+    throw runtime_error("Expect " + to_string(existing) + " shards in " +
+                        path);
+  }
+  mkdir(path.c_str(), 0755);
+
+  // Initializing an existing repository opens it.
+  manifest_.reset(new Repository(path + "/manifest", true));
+  for (size_t i = 0; i < shards; ++i) {
+    shards_.emplace_back(new Repository(path + "/" + shardName(i), true));
+  }
+  pool_.reset(new ThreadPool(max<size_t>(1, min(threads, shards))));
+}
+
+ShardedRepository::~ShardedRepository() {
+  // Wait for the threads before the shards go away.
+  pool_.reset();
+}
+
+size_t ShardedRepository::shardOf(const string& path) const {
+  return router_(path, shards_.size()) % shards_.size();
+}
+
+string ShardedRepository::commit(
+    const string& authorName,
+    const string& authorEmail,
+    const string& message,
+    const unordered_map<string, string>& additions,
+    const unordered_set<string>& deletions) {
+  size_t n = shards_.size();
+  vector<unordered_map<string, string>> shardAdditions(n);
+  vector<unordered_set<string>> shardDeletions(n);
+  for (auto& p : additions) {
+    shardAdditions[shardOf(p.first)].insert(p);
+  }
+  for (auto& p : deletions) {
+    shardDeletions[shardOf(p)].insert(p);
+  }
+
+  // The tips before the commit, to roll the shards back to if the
+  // sharded commit fails, and to point the manifest to for unchanged
+  // shards.
+  vector<git_oid> tips(n);
+  vector<bool> hasTips(n);
+  for (size_t i = 0; i < n; ++i) {
+    hasTips[i] = shards_[i]->readReference("HEAD", &tips[i]);
+  }
+
+  // Each shard is committed by one thread.
+  vector<string> ids(n);
+  vector<future<void>> done;
+  for (size_t i = 0; i < n; ++i) {
+    if (shardAdditions[i].empty() && shardDeletions[i].empty()) {
+      continue;
+    }
+    done.push_back(pool_->submit([&, i] {
+      ids[i] = shards_[i]->commit(
+          "HEAD",
+          authorName,
+          authorEmail,
+          message,
+          shardAdditions[i],
+          shardDeletions[i]);
+    }));
+  }
+  bool ok = true;
+  try {
+    waitAll(done);
+  } catch (const exception& ex) {
+    cerr << ex.what() << endl;
+    ok = false;
+  }
+  for (size_t i = 0; i < n; ++i) {
+    if (ids[i].empty() &&
+        (!shardAdditions[i].empty() || !shardDeletions[i].empty())) {
+      cerr << "Fails to commit " << shardName(i) << endl;
+      ok = false;
+    }
+  }
+
+  vector<const git_oid*> manifestTips(n);
+  vector<git_oid> newTips(n);
+  bool moved = false;
+  for (size_t i = 0; i < n && ok; ++i) {
+    if (!ids[i].empty()) {
+      git_oid_fromstr(&newTips[i], ids[i].c_str());
+      manifestTips[i] = &newTips[i];
+      moved = moved || !hasTips[i] || !git_oid_equal(&newTips[i], &tips[i]);
+    } else if (hasTips[i]) {
+      manifestTips[i] = &tips[i];
+    }
+  }
+  git_oid id;
+  if (ok && !moved) {
+    // The manifest already points to the shard tips.
+    if (!manifest_->readReference("HEAD", &id)) {
+      return string();
+    }
+  } else if (!ok ||
+      !commitManifest(&id, manifestTips, authorName, authorEmail, message)) {
+    rollBack(ids, tips, hasTips);
+    return string();
+  }
+  string ret;
+  ret.resize(GIT_OID_HEXSZ);
+  git_oid_nfmt(const_cast<char*>(ret.data()), ret.size(), &id);
+  return ret;
+}
+
+void ShardedRepository::rollBack(
+    const vector<string>& ids,
+    const vector<git_oid>& tips,
+    const vector<bool>& hasTips) {
+  for (size_t i = 0; i < ids.size(); ++i) {
+    if (ids[i].empty()) {
+      continue;
+    }
+    git_oid id;
+    git_oid_fromstr(&id, ids[i].c_str());
+    int ret;
+    if (hasTips[i]) {
+      char hex[GIT_OID_HEXSZ + 1];
+      git_oid_tostr(hex, sizeof(hex), &tips[i]);
+      ret = shards_[i]->updateReference(
+          "HEAD", &tips[i], &id, string("reset: moving to ") + hex);
+    } else {
+      // The shard had no commit, so its branch goes away. Deleting the
+      // reference checks it still points to the new commit.
+      string name = shards_[i]->resolveReferenceName("HEAD");
+      git_reference* out = nullptr;
+      ret = git_reference_lookup(&out, shards_[i]->get(), name.c_str());
+      if (ret == 0) {
+        unique_ptr<git_reference> ref(out);
+        auto target = git_reference_target(ref.get());
+        ret = (target && git_oid_equal(target, &id))
+            ? git_reference_delete(ref.get()) : GIT_EMODIFIED;
+      }
+    }
+    if (ret != 0) {
+      cerr << "Fails to roll back " << shardName(i) << endl;
+    }
+  }
+}
+
+bool ShardedRepository::commitManifest(
+    git_oid* id,
+    const vector<const git_oid*>& tips,
+    const string& authorName,
+    const string& authorEmail,
+    const string& message) {
+  git_repository* repo = manifest_->get();
+  git_treebuilder* tmp = nullptr;
+  if (0 != git_treebuilder_new(&tmp, repo, nullptr)) {
+    return false;
+  }
+  unique_ptr<git_treebuilder> builder(tmp);
+
+  // Shards without a commit yet are left out.
+  for (size_t i = 0; i < tips.size(); ++i) {
+    if (tips[i] == nullptr) {
+      continue;
+    }
+    if (0 != git_treebuilder_insert(nullptr, builder.get(),
+                                    shardName(i).c_str(), tips[i],
+                                    GIT_FILEMODE_COMMIT)) {
+      return false;
+    }
+  }
+  git_oid treeId;
+  if (0 != git_treebuilder_write(&treeId, builder.get())) {
+    cerr << "Fails to write the manifest tree" << endl;
+    return false;
+  }
+
+  git_oid parent;
+  bool hasParent = manifest_->readReference("HEAD", &parent);
+  const git_oid* parents[] = { &parent };
+
+  git_signature* sig = nullptr;
+  if (0 != git_signature_now(&sig, authorName.c_str(), authorEmail.c_str())) {
+    return false;
+  }
+  int ret = git_commit_create_from_ids(
+                id,
+                repo,
+                nullptr, /*const char* update_ref*/
+                sig, /*const gitsignature* author*/
+                sig, /*const gitsignature* committer*/
+                nullptr, /*const char* message_encoding*/
+                message.c_str(),
+                &treeId,
+                hasParent ? 1 : 0,
+                parents);
+  git_signature_free(sig);
+  if (ret != 0) {
+    cerr << "Fails to commit the manifest" << endl;
+    return false;
+  }
+  // The manifest moves like any other reference of the wrapper, so that
+  // it follows its batches and reference database.
+  if (0 != manifest_->updateReference(
+          "HEAD", id, hasParent ? &parent : nullptr,
+          commitLogMessage(message, !hasParent))) {
+    cerr << "Fails to update the manifest" << endl;
+    return false;
+  }
+  return true;
+}
+
+} // libgit2pp
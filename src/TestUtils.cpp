@@ -1,4 +1,6 @@
 #include "TestUtils.h"
+#include "Wrapper.h"
+
 #include <sstream>
 #include <stdexcept>
 
@@ -52,4 +54,68 @@ vector<string> splitFilePath(const string& path) {
   return ret;
 }
 
+string commitFiles(
+    Repository* r,
+    const unordered_map<string, string>& files) {
+  string id = r->commit(
+      "HEAD",
+      "My Name",
+      "my.name@gmail.com",
+      "A testing commit",
+      files,
+      unordered_set<string>());
+  if (id.empty()) {
+    throw runtime_error("Fails to create a commit");
+  }
+  return id;
+}
+
+namespace {
+
+// The entry at @param path in the tree of HEAD, or nullptr.
+git_tree_entry* headEntry(Repository* r, const string& path) {
+  unique_ptr<git_reference> head(r->getHead());
+  if (head.get() == nullptr) {
+    return nullptr;
+  }
+  unique_ptr<git_commit> c(r->getCommit(git_reference_target(head.get())));
+  git_tree* tmpTree = nullptr;
+  if (c.get() == nullptr || 0 != git_commit_tree(&tmpTree, c.get())) {
+    throw runtime_error("Fails to get the tree of HEAD");
+  }
+  unique_ptr<git_tree> tree(tmpTree);
+  git_tree_entry* entry = nullptr;
+  if (0 != git_tree_entry_bypath(&entry, tree.get(), path.c_str())) {
+    return nullptr;
+  }
+  return entry;
+}
+
+} // namespace
+
+string blobAt(Repository* r, const string& path) {
+  unique_ptr<git_tree_entry> entry(headEntry(r, path));
+  if (entry.get() == nullptr) {
+    return string();
+  }
+  char hex[GIT_OID_HEXSZ + 1];
+  git_oid_tostr(hex, sizeof(hex), git_tree_entry_id(entry.get()));
+  return hex;
+}
+
+string readHeadFile(Repository* r, const string& path) {
+  unique_ptr<git_tree_entry> entry(headEntry(r, path));
+  if (entry.get() == nullptr) {
+    throw runtime_error("Expect to find " + path);
+  }
+  git_blob* blob = nullptr;
+  if (0 != git_blob_lookup(&blob, r->get(), git_tree_entry_id(entry.get()))) {
+    throw runtime_error("Fails to read " + path);
+  }
+  string data(static_cast<const char*>(git_blob_rawcontent(blob)),
+              git_blob_rawsize(blob));
+  git_blob_free(blob);
+  return data;
+}
+
 }
@@ -0,0 +1,61 @@
+#include "ThreadPool.h"
+
+using namespace std;
+
+namespace libgit2pp {
+
+ThreadPool::ThreadPool(size_t threads) : stop_(false) {
+  for (size_t i = 0; i < threads; ++i) {
+    threads_.emplace_back([this] { run(); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  for (auto& t : threads_) {
+    t.join();
+  }
+}
+
+future<void> ThreadPool::submit(function<void()> task) {
+  packaged_task<void()> pt(std::move(task));
+  auto ret = pt.get_future();
+  {
+    lock_guard<mutex> lock(mutex_);
+    tasks_.push_back(std::move(pt));
+  }
+  cv_.notify_one();
+  return ret;
+}
+
+void ThreadPool::run() {
+  for (;;) {
+    packaged_task<void()> task;
+    {
+      unique_lock<mutex> lock(mutex_);
+      cv_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+      if (tasks_.empty()) {
+        // Stopping, and nothing is left to run.
+        return;
+      }
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+    task();
+  }
+}
+
+void waitAll(vector<future<void>>& done) {
+  for (auto& f : done) {
+    f.wait();
+  }
+  for (auto& f : done) {
+    f.get();
+  }
+}
+
+} // libgit2pp
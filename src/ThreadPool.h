@@ -0,0 +1,46 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace libgit2pp {
+
+// A fixed-size pool of threads running tasks in the order submitted.
+class ThreadPool {
+ public:
+  // Start @param threads threads.
+  explicit ThreadPool(size_t threads);
+
+  // Wait for submitted tasks to finish, then stop the threads.
+  ~ThreadPool();
+
+  size_t size() const { return threads_.size(); }
+
+  /**
+   Run a task on one of the threads.
+
+   @returns a future that becomes ready when the task finishes. An
+            exception thrown by the task is rethrown by the future.
+  */
+  std::future<void> submit(std::function<void()> task);
+
+ private:
+  std::vector<std::thread> threads_;
+  std::deque<std::packaged_task<void()>> tasks_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stop_;
+
+  void run();
+};
+
+// Wait for every task of @param done to finish, then rethrow the first
+// exception, so that no task still runs once the caller leaves its scope.
+void waitAll(std::vector<std::future<void>>& done);
+
+} // libgit2pp
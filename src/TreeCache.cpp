@@ -0,0 +1,80 @@
+#include "TreeCache.h"
+
+using namespace std;
+
+namespace libgit2pp {
+
+TreeCache::TreeCache(size_t capacity) : capacity_(capacity) {
+}
+
+TreeCache::~TreeCache() {
+}
+
+unique_ptr<git_treebuilder> TreeCache::take(
+    const string& path,
+    const git_oid* id) {
+  auto it = index_.find(path);
+  if (it == index_.end()) {
+    return nullptr;
+  }
+
+  // Either the caller owns the builder now, or the entry is stale. The
+  // emptied entry stays, so that putting the path back does not allocate.
+  auto& entry = *it->second;
+  unique_ptr<git_treebuilder> ret = std::move(entry.builder);
+  if (ret && 0 != git_oid_cmp(&entry.id, id)) {
+    ret.reset();
+  }
+  return ret;
+}
+
+void TreeCache::put(
+    const string& path,
+    const git_oid* id,
+    unique_ptr<git_treebuilder> builder) {
+  if (capacity_ == 0) {
+    return;
+  }
+
+  // Update an existing entry in place, which is the common case for
+  // consecutive commits, to avoid allocations.
+  auto it = index_.find(path);
+  if (it != index_.end()) {
+    lru_.splice(lru_.begin(), lru_, it->second);
+  } else {
+    lru_.emplace_front();
+    lru_.front().path = path;
+    index_[path] = lru_.begin();
+  }
+
+  auto& entry = lru_.front();
+  git_oid_cpy(&entry.id, id);
+  entry.builder = std::move(builder);
+
+  evict();
+}
+
+bool TreeCache::contains(const string& path, const git_oid* id) const {
+  auto it = index_.find(path);
+  return it != index_.end() && it->second->builder &&
+         0 == git_oid_cmp(&it->second->id, id);
+}
+
+void TreeCache::setCapacity(size_t capacity) {
+  capacity_ = capacity;
+  evict();
+}
+
+void TreeCache::clear() {
+  index_.clear();
+  lru_.clear();
+}
+
+void TreeCache::evict() {
+  while (index_.size() > capacity_) {
+    index_.erase(lru_.back().path);
+    lru_.pop_back();
+  }
+}
+
+} // libgit2pp
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "Wrapper.h"
+
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace libgit2pp {
+
+/**
+ A bounded cache of the trees written by recent commits. This class is
+ used by Repository to build consecutive commits without reading the
+ same trees back from the object database.
+
+ Each entry maps the relative path of a tree to the treebuilder that
+ wrote it, together with the object ID it was written as. An entry is
+ only handed out if the caller asks for the same object ID, so the cache
+ stays correct when the reference moves outside the wrapper: a stale
+ entry simply never matches again and ages out.
+*/
+class TreeCache {
+ public:
+  // @param capacity the maximum number of trees kept. 0 disables the cache.
+  explicit TreeCache(size_t capacity);
+
+  ~TreeCache();
+
+  /**
+   Take the treebuilder cached for @param path out of the cache. The
+   entry is emptied either way.
+
+   @param path the relative path of the tree. The root tree is "".
+   @param id the object ID the caller expects the tree to have.
+   @returns nullptr if there is no entry for the path, or if the entry
+            was written as a different object ID.
+  */
+  std::unique_ptr<git_treebuilder> take(
+      const std::string& path,
+      const git_oid* id);
+
+  /**
+   Put a treebuilder into the cache, replacing the entry for the same
+   path and evicting the least recently written trees if the cache grows
+   over its capacity.
+
+   @param path the relative path of the tree. The root tree is "".
+   @param id the object ID the treebuilder was just written as.
+  */
+  void put(
+      const std::string& path,
+      const git_oid* id,
+      std::unique_ptr<git_treebuilder> builder);
+
+  // Test if the tree at @param path is cached as @param id.
+  bool contains(const std::string& path, const git_oid* id) const;
+
+  // Change the maximum number of trees kept.
+  void setCapacity(size_t capacity);
+
+  // Drop all entries.
+  void clear();
+
+  size_t size() const { return index_.size(); }
+
+ private:
+  struct Entry {
+    std::string path;
+    git_oid id;
+    std::unique_ptr<git_treebuilder> builder;
+  };
+
+  size_t capacity_;
+
+  // Most recently written entries are at the front.
+  std::list<Entry> lru_;
+
+  std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+
+  void evict();
+};
+
+} // libgit2pp
@@ -0,0 +1,107 @@
+#include "TreeIterator.h"
+
+#include <stdexcept>
+
+using namespace std;
+
+namespace libgit2pp {
+
+TreeIterator::TreeIterator(
+    git_repository* repo,
+    const git_tree* tree,
+    const string& prefix,
+    size_t maxDepth)
+    : repo_(repo), maxDepth_(maxDepth) {
+  // Most trees are a few levels deep.
+  stack_.reserve(16);
+  path_.reserve(256);
+
+  git_tree* start = nullptr;
+  if (prefix.empty()) {
+    if (0 != git_tree_dup(&start, const_cast<git_tree*>(tree))) {
+      throw runtime_error("Fails to duplicate a tree");
+    }
+  } else {
+    git_tree_entry* tmpEntry = nullptr;
+    if (0 != git_tree_entry_bypath(&tmpEntry, tree, prefix.c_str())) {
+      return;
+    }
+    unique_ptr<git_tree_entry> entry(tmpEntry);
+    if (git_tree_entry_type(entry.get()) != GIT_OBJ_TREE) {
+      return;
+    }
+    if (0 != git_tree_lookup(&start, repo_, git_tree_entry_id(entry.get()))) {
+      throw runtime_error("Fails to read a tree");
+    }
+    path_ = prefix;
+    if (path_.back() != '/') {
+      path_ += '/';
+    }
+  }
+  if (!push(start)) {
+    advance(false);
+  }
+}
+
+TreeEntry TreeIterator::operator*() const {
+  auto& l = stack_.back();
+  return TreeEntry {
+    experimental::string_view(path_),
+    git_tree_entry_byindex(l.tree.get(), l.index),
+    stack_.size() - 1,
+  };
+}
+
+bool TreeIterator::push(git_tree* tree) {
+  Level l;
+  l.tree.reset(tree);
+  l.index = 0;
+  l.count = git_tree_entrycount(tree);
+  l.pathSize = path_.size();
+  stack_.push_back(std::move(l));
+  if (stack_.back().count == 0) {
+    return false;
+  }
+  load();
+  return true;
+}
+
+void TreeIterator::advance(bool descend) {
+  if (stack_.empty()) {
+    return;
+  }
+  auto& top = stack_.back();
+  auto entry = git_tree_entry_byindex(top.tree.get(), top.index);
+  if (descend && git_tree_entry_type(entry) == GIT_OBJ_TREE &&
+      stack_.size() <= maxDepth_) {
+    git_tree* subtree = nullptr;
+    if (0 != git_tree_lookup(&subtree, repo_, git_tree_entry_id(entry))) {
+      throw runtime_error("Fails to read a tree");
+    }
+    path_ += '/';
+    if (push(subtree)) {
+      return;
+    }
+  }
+
+  // The next entry of the deepest tree that has one left.
+  while (true) {
+    auto& l = stack_.back();
+    if (++l.index < l.count) {
+      load();
+      return;
+    }
+    stack_.pop_back();
+    if (stack_.empty()) {
+      return;
+    }
+  }
+}
+
+void TreeIterator::load() {
+  auto& l = stack_.back();
+  path_.resize(l.pathSize);
+  path_ += git_tree_entry_name(git_tree_entry_byindex(l.tree.get(), l.index));
+}
+
+} // libgit2pp
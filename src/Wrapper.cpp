@@ -1,49 +1,205 @@
 #include "Wrapper.h"
-#include "TestUtils.h"
-
+#include "git2/sys/commit.h"
+#include "git2/sys/mempack.h"
+#include "git2/sys/odb_backend.h"
+#include "git2/sys/refdb_backend.h"
+#include "git2/sys/repository.h"
+#include "ChangeSet.h"
+#include "CompressionBackend.h"
+#include "HistoryIndex.h"
+#include "LogBackend.h"
+#include "MaintenanceScheduler.h"
+#include "MemoryRefdb.h"
+#include "OidSet.h"
+#include "ThreadPool.h"
+#include "TreeCache.h"
+
+#include <algorithm>
+#include <cstring>
 #include <stdexcept>
 #include <iostream>
 #include <vector>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <queue>
+#include <thread>
 #include <tuple>
-#include <sstream>
-#include <map>
 
+#include <fcntl.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 using namespace std;
 
 namespace libgit2pp {
 
-Repository::Repository(git_repository* repo) : repo_(repo) {
+// Size of the chunks blobs are streamed in.
+const size_t blobChunkSize = 64 * 1024;
+
+// Default number of trees kept between consecutive commits.
+const size_t defaultTreeCacheSize = 1024;
+
+// Minimum number of changed files for building sub-trees in parallel.
+const size_t parallelMinFiles = 256;
+
+// Minimum number of blobs for creating them in parallel.
+const size_t parallelMinBlobs = 4;
+
+// Minimum number of files for reading them in parallel.
+const size_t parallelMinReads = 16;
+
+// Maximum number of blob IDs remembered for skipping duplicate writes.
+const size_t knownBlobsSize = 1 << 20;
+
+// Maximum number of commits kept until a reference lands on them.
+const size_t maxUnlanded = 1 << 16;
+
+// Priority of the in-memory backend of a batch in the object database.
+const int mempackPriority = 1000;
+
+// Priority of the log backend, between the in-memory backend of a batch
+// and the loose and packed backends.
+const int logPriority = 500;
+
+// Priority of the compression backend, above the loose backend it
+// replaces for writes.
+const int compressionPriority = 100;
+
+// Size of the header and the trailing checksum of a packfile.
+const size_t packOverhead = 12 + 20;
+
+// The raw bytes of an object ID, as a key of unordered maps.
+string oidKey(const git_oid* id) {
+  return string(reinterpret_cast<const char*>(id->id), GIT_OID_RAWSZ);
+}
+
+string commitLogMessage(const string& message, bool initial) {
+  size_t begin = message.find_first_not_of(" \t\r\n");
+  string summary;
+  if (begin != string::npos) {
+    size_t end = message.find('\n', begin);
+    summary = message.substr(
+        begin, end == string::npos ? string::npos : end - begin);
+    summary.erase(summary.find_last_not_of(" \t\r") + 1);
+  }
+  return (initial ? "commit (initial): " : "commit: ") + summary;
+}
+
+// Repositories whose durability is Strict. libgit2 only syncs files for
+// the whole process, so the option is on while there is any.
+mutex strictMutex;
+size_t strictRepositories = 0;
+
+void holdStrict(bool hold) {
+  lock_guard<mutex> lock(strictMutex);
+  if (hold ? strictRepositories++ == 0 : --strictRepositories == 0) {
+    git_libgit2_opts(GIT_OPT_ENABLE_FSYNC_GITDIR, hold ? 1 : 0);
+  }
+}
+
+bool syncsAllWrites() {
+  lock_guard<mutex> lock(strictMutex);
+  return strictRepositories > 0;
+}
+
+Repository::Repository(git_repository* repo)
+    : repo_(repo),
+      treeCache_(new TreeCache(defaultTreeCacheSize)),
+      knownBlobs_(new OidSet(knownBlobsSize)),
+      mempack_(nullptr),
+      maintenance_(nullptr),
+      logSegmentSize_(0),
+      refdb_(nullptr),
+      durability_(Durability::None) {
 }
 
-Repository::Repository(const string& path) {
+Repository::Repository(const string& path)
+    : treeCache_(new TreeCache(defaultTreeCacheSize)),
+      knownBlobs_(new OidSet(knownBlobsSize)),
+      mempack_(nullptr),
+      maintenance_(nullptr),
+      logSegmentSize_(0),
+      refdb_(nullptr),
+      durability_(Durability::None) {
   if (0 != git_repository_open(&repo_, path.c_str())) {
     throw runtime_error("Fails to open a repository");
   }
 }
 
-Repository::Repository(const string& path, bool isBare) {
+Repository::Repository(const string& path, bool isBare)
+    : treeCache_(new TreeCache(defaultTreeCacheSize)),
+      knownBlobs_(new OidSet(knownBlobsSize)),
+      mempack_(nullptr),
+      maintenance_(nullptr),
+      logSegmentSize_(0),
+      refdb_(nullptr),
+      durability_(Durability::None) {
   if (0 != git_repository_init(&repo_, path.c_str(), isBare)) {
     throw runtime_error("Fails to create a repository");
   }
 }
 
 Repository::Repository(const std::string& url, const std::string& localPath)
-    : repo_(nullptr) {
+    : repo_(nullptr),
+      treeCache_(new TreeCache(defaultTreeCacheSize)),
+      knownBlobs_(new OidSet(knownBlobsSize)),
+      mempack_(nullptr),
+      maintenance_(nullptr),
+      logSegmentSize_(0),
+      refdb_(nullptr),
+      durability_(Durability::None) {
   if (0 != git_clone(&repo_, url.c_str(), localPath.c_str(), nullptr)) {
     throw runtime_error("Fails to clone a git repository");
   }
 }
 
-Repository::Repository(Repository&& b) {
+Repository::Repository(Repository&& b)
+    : repo_(nullptr),
+      mempack_(nullptr),
+      maintenance_(nullptr),
+      logSegmentSize_(0),
+      refdb_(nullptr),
+      durability_(Durability::None) {
   std::swap(repo_, b.repo_);
+  std::swap(treeCache_, b.treeCache_);
+  std::swap(pool_, b.pool_);
+  std::swap(workers_, b.workers_);
+  std::swap(knownBlobs_, b.knownBlobs_);
+  std::swap(stats_, b.stats_);
+  std::swap(mempack_, b.mempack_);
+  std::swap(batchMaxBytes_, b.batchMaxBytes_);
+  std::swap(batchMaxAge_, b.batchMaxAge_);
+  std::swap(batchBytes_, b.batchBytes_);
+  std::swap(batchStart_, b.batchStart_);
+  std::swap(maintenance_, b.maintenance_);
+  std::swap(logSegmentSize_, b.logSegmentSize_);
+  std::swap(compression_, b.compression_);
+  std::swap(refdb_, b.refdb_);
+  std::swap(durability_, b.durability_);
+  std::swap(history_, b.history_);
+  std::swap(pendingRefs_, b.pendingRefs_);
+  std::swap(unlanded_, b.unlanded_);
+  std::swap(unlandedOrder_, b.unlandedOrder_);
+  std::swap(unlandedSeq_, b.unlandedSeq_);
+  std::swap(tips_, b.tips_);
+  std::swap(lastCommit_, b.lastCommit_);
 }
 
 Repository::~Repository() {
+  if (mempack_) {
+    flushBatch();
+  }
+  // References are written while the repository is still usable.
+  if (refdb_) {
+    flushRefs();
+  }
   if (repo_) {
     git_repository_free(repo_);
   }
+  if (durability_ == Durability::Strict) {
+    holdStrict(false);
+  }
 }
 
 string Repository::commit(
@@ -53,57 +209,336 @@ string Repository::commit(
     const string& message,
     const unordered_map<string, string>& additions,
     const unordered_set<string> deletions) {
-  // Obtain a tmpfile to write file contents to.
-  string tmpfile;
-  {
-    stringstream ss;
-    ss << "/tmp/git_commits/" << (uint64_t)pthread_self();
-    auto tmpdir = ss.str();
-    string cmd = string("mkdir -p ") + tmpdir;
-    system(cmd.c_str());
-    tmpfile = tmpdir + "/txt";
+  git_oid parent;
+  bool hasParent = resolveTip("HEAD", &parent);
+
+  git_oid id;
+  if (!createCommit(
+          &id,
+          hasParent ? &parent : nullptr,
+          updateRef,
+          authorName,
+          authorEmail,
+          message,
+          additions,
+          deletions)) {
+    return string();
   }
 
-  // Create blob objects.
+  string ret;
+  ret.resize(GIT_OID_HEXSZ);
+  git_oid_nfmt(const_cast<char*>(ret.data()), ret.size(), &id);
+  return ret;
+}
+
+bool Repository::createCommit(
+    git_oid* id,
+    const git_oid* parent,
+    const string& updateRef,
+    const string& authorName,
+    const string& authorEmail,
+    const string& message,
+    const unordered_map<string, string>& additions,
+    const unordered_set<string>& deletions) {
+  // Create blob objects straight from the contents in memory.
   vector<git_oid> oids(additions.size());
   unordered_map<string, git_oid*> addedFiles;
   {
+    vector<const string*> contents;
+    contents.reserve(additions.size());
     int idx = 0;
     for (auto& p : additions) {
-      writeToFile(tmpfile, p.second);
-      addedFiles[p.first] = &oids[idx];
-      if (!createBlobFromDisk(tmpfile, &oids[idx++])) {
-        throw runtime_error("Fails to create an object in git");
-      }
-      unlink(tmpfile.c_str());
+      addedFiles[p.first] = &oids[idx++];
+      contents.push_back(&p.second);
     }
+    createBlobs(contents, oids.data());
   }
 
-  git_oid id;
-  if (createTreeUsingCommit(&id, "", addedFiles, deletions)) {
-    unique_ptr<git_commit> c(getHeadCommit());
-    unique_ptr<git_tree> tree(getTree(&id));
-
-    if (c.get() != nullptr) {
-      // There are commits before.
-      const git_commit* parents[] = { c.get() };
-      if (!commit(&id, updateRef, authorName, authorEmail, message,
-          tree.get(), 1, parents)) {
+  // Build the tree on top of the parent's tree.
+  const git_oid* source = nullptr;
+  git_oid parentTree;
+  if (parent != nullptr) {
+    if (!getTreeOf(parent, &parentTree)) {
+      cerr << "Fails to get commit" << endl;
+      return false;
+    }
+    source = &parentTree;
+  }
+  git_oid treeId;
+  if (!createTreeUsingGitTree(&treeId, source, addedFiles, deletions)) {
+    return false;
+  }
+
+  git_signature* sig = nullptr;
+  if (0 != git_signature_now(&sig, authorName.c_str(), authorEmail.c_str())) {
+    return false;
+  }
+  // The reference is moved by updateReference(), which orders it after
+  // the objects.
+  const git_oid* parents[] = { parent };
+  int ret = git_commit_create_from_ids(
+                id,
+                repo_,
+                nullptr, /*const char* update_ref*/
+                sig, /*const gitsignature* author*/
+                sig, /*const gitsignature* committer*/
+                nullptr, /*const char* message_encoding*/
+                message.c_str(),
+                &treeId,
+                parent != nullptr ? 1 : 0,
+                parents);
+
+  git_signature_free(sig);
+  if (ret != 0) {
+    return false;
+  }
+  if (history_ || !oids.empty()) {
+    Unlanded& u = addUnlanded(id);
+    u.hasParent = (parent != nullptr);
+    if (parent != nullptr) {
+      git_oid_cpy(&u.parent, parent);
+      git_oid_cpy(&u.parentTree, source);
+    }
+    git_oid_cpy(&u.tree, &treeId);
+    u.blobs = std::move(oids);
+  }
+  // Like git_commit_create(), the reference must still point to the
+  // parent.
+  if (!updateRef.empty() &&
+      0 != updateReference(updateRef, id, parent,
+                           commitLogMessage(message, parent == nullptr))) {
+    cerr << "Fails to update " << updateRef << endl;
+    return false;
+  }
+
+  // The next commit on top of this one doesn't need to read it.
+  lastCommit_ = Tip{*id, treeId};
+  if (!updateRef.empty()) {
+    tips_[updateRef] = lastCommit_;
+  }
+
+  if (maintenance_ && !mempack_ && logSegmentSize_ == 0) {
+    maintenance_->notify(stats_.blobsWritten + stats_.treesWritten + 1);
+  }
+  if (mempack_) {
+    for (auto& p : additions) {
+      batchBytes_ += p.second.size();
+    }
+    // If the flush fails, the commit stays in the batch, and is written
+    // by the next flush.
+    if (batchBytes_ >= batchMaxBytes_ ||
+        chrono::steady_clock::now() - batchStart_ >= batchMaxAge_) {
+      flushBatch();
+    }
+  }
+  return true;
+}
+
+// Number of times commitMatching() rebases a commit onto a new tip.
+const int maxRebaseAttempts = 16;
+
+// Number of times a locked reference is tried again.
+const int maxLockAttempts = 1000;
+
+/**
+ Check whether a path is the same in two trees. Parent directories of the
+ path must have the same type too, so that the changes of a commit based
+ on @param base can be applied on @param tip.
+
+ @param base, tip the trees to compare. nullptr is an empty tree.
+*/
+bool samePath(const git_tree* base, const git_tree* tip, const string& path) {
+  auto lookup = [](const git_tree* tree, const string& p) {
+    git_tree_entry* entry = nullptr;
+    if (tree != nullptr) {
+      git_tree_entry_bypath(&entry, tree, p.c_str());
+    }
+    return unique_ptr<git_tree_entry>(entry);
+  };
+
+  for (size_t pos = path.find('/'); pos != string::npos;
+       pos = path.find('/', pos + 1)) {
+    auto a = lookup(base, path.substr(0, pos));
+    auto b = lookup(tip, path.substr(0, pos));
+    auto typeOf = [](const git_tree_entry* e) {
+      return e != nullptr ? git_tree_entry_type(e) : GIT_OBJ_BAD;
+    };
+    if (typeOf(a.get()) != typeOf(b.get())) {
+      return false;
+    }
+  }
+
+  auto a = lookup(base, path);
+  auto b = lookup(tip, path);
+  if (a.get() == nullptr || b.get() == nullptr) {
+    return a.get() == b.get();
+  }
+  return git_tree_entry_filemode(a.get()) == git_tree_entry_filemode(b.get())
+      && git_oid_equal(git_tree_entry_id(a.get()), git_tree_entry_id(b.get()));
+}
+
+string Repository::commitMatching(
+    const string& parent,
+    const string& updateRef,
+    const string& authorName,
+    const string& authorEmail,
+    const string& message,
+    const unordered_map<string, string>& additions,
+    const unordered_set<string>& deletions) {
+  git_oid base;
+  bool hasBase = !parent.empty();
+  if (hasBase && 0 != git_oid_fromstr(&base, parent.c_str())) {
+    cerr << "Invalid parent " << parent << endl;
+    return string();
+  }
+  // HEAD may point to a branch that doesn't exist yet.
+  string refName = resolveReferenceName(updateRef);
+
+  for (int i = 0; i < maxRebaseAttempts; ++i) {
+    git_oid id;
+    if (!createCommit(
+            &id,
+            hasBase ? &base : nullptr,
+            string(),
+            authorName,
+            authorEmail,
+            message,
+            additions,
+            deletions)) {
+      return string();
+    }
+
+    int ret;
+    for (int j = 0; ; ++j) {
+      ret = updateReference(
+          refName, &id, hasBase ? &base : nullptr,
+          commitLogMessage(message, !hasBase));
+      if (ret != GIT_ELOCKED || j == maxLockAttempts) {
+        break;
+      }
+      // Another writer is updating the reference.
+      this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    if (ret == 0) {
+      string hex;
+      hex.resize(GIT_OID_HEXSZ);
+      git_oid_nfmt(const_cast<char*>(hex.data()), hex.size(), &id);
+      return hex;
+    }
+    if (ret != GIT_EMODIFIED && ret != GIT_EEXISTS) {
+      cerr << "Fails to update " << refName << endl;
+      return string();
+    }
+
+    // The reference was moved. Rebase if the new tip didn't touch any
+    // path of this commit.
+    git_oid tip;
+    if (!readReference(refName, &tip)) {
+      return string();
+    }
+    unique_ptr<git_tree> baseTree, tipTree;
+    if (hasBase) {
+      unique_ptr<git_commit> c(getCommit(&base));
+      if (c.get() == nullptr) {
         return string();
       }
-    } else {
-      // This is the first commit in the repository.
-      if (!commit(&id, updateRef, authorName, authorEmail, message,
-          tree.get(), 0, nullptr)) {
+      baseTree.reset(getTree(git_commit_tree_id(c.get())));
+    }
+    {
+      unique_ptr<git_commit> c(getCommit(&tip));
+      if (c.get() == nullptr) {
         return string();
       }
+      tipTree.reset(getTree(git_commit_tree_id(c.get())));
     }
+    for (auto& p : additions) {
+      if (!samePath(baseTree.get(), tipTree.get(), p.first)) {
+        cerr << p.first << " was changed on " << refName << endl;
+        return string();
+      }
+    }
+    for (auto& p : deletions) {
+      if (!samePath(baseTree.get(), tipTree.get(), p)) {
+        cerr << p << " was changed on " << refName << endl;
+        return string();
+      }
+    }
+    base = tip;
+    hasBase = true;
   }
+  cerr << "Gives up updating " << refName << endl;
+  return string();
+}
 
-  string ret;
-  ret.resize(GIT_OID_HEXSZ);
-  git_oid_nfmt(const_cast<char*>(ret.data()), ret.size(), &id);
-  return ret;
+void Repository::createBlobs(
+    const vector<const string*>& contents,
+    git_oid* ids) {
+  stats_ = CommitStats();
+
+  // Workers can't write to the in-memory backend of a batch.
+  if (!pool_ || mempack_ || contents.size() < parallelMinBlobs) {
+    for (size_t i = 0; i < contents.size(); ++i) {
+      if (createBlobIfMissing(this, *contents[i], &ids[i])) {
+        ++stats_.blobsWritten;
+      } else {
+        ++stats_.blobsDeduplicated;
+      }
+    }
+    return;
+  }
+
+  // Each worker hashes, compresses and writes its share of the blobs
+  // through its own object database. Loose objects are written to
+  // separate files, so the workers do not contend.
+  atomic<size_t> written(0);
+  // Files with the same contents are written by the first worker to get
+  // to them.
+  mutex claimedMutex;
+  unordered_set<string> claimed;
+  auto claim = [&](const git_oid* id) {
+    lock_guard<mutex> lock(claimedMutex);
+    return claimed.insert(oidKey(id)).second;
+  };
+  vector<future<void>> done;
+  for (size_t w = 0; w < workers_.size(); ++w) {
+    auto worker = workers_[w].get();
+    done.push_back(pool_->submit([&, w, worker] {
+      for (size_t i = w; i < contents.size(); i += workers_.size()) {
+        if (createBlobIfMissing(worker, *contents[i], &ids[i], claim)) {
+          ++written;
+        }
+      }
+    }));
+  }
+
+  waitAll(done);
+  stats_.blobsWritten = written;
+  stats_.blobsDeduplicated = contents.size() - written;
+}
+
+bool Repository::createBlobIfMissing(
+    Repository* handle,
+    const string& data,
+    git_oid* id,
+    const function<bool(const git_oid*)>& claim) {
+  // Hashing is much cheaper than compressing and writing.
+  if (0 != git_odb_hash(id, data.data(), data.size(), GIT_OBJ_BLOB)) {
+    throw runtime_error("Fails to hash an object");
+  }
+  if (knownBlobs_->contains(id) || (claim && !claim(id))) {
+    return false;
+  }
+
+  unique_ptr<git_odb> odb(handle->getOdb());
+  if (odb.get() == nullptr) {
+    throw runtime_error("Fails to open the object database");
+  }
+  bool exists = git_odb_exists(odb.get(), id);
+  if (!exists && !handle->createBlobFromBuffer(data, id)) {
+    throw runtime_error("Fails to create an object in git");
+  }
+  // The blob is only remembered once a commit using it lands, see land().
+  return !exists;
 }
 
 bool Repository::createTreeUsingExistingTree(
@@ -111,22 +546,16 @@ bool Repository::createTreeUsingExistingTree(
     const string& source,
     const unordered_map<std::string, git_oid*>& addedFiles,
     const unordered_set<std::string>& deletedFiles) {
-  git_tree* tree = nullptr;
+  git_oid treeId;
   if (!source.empty()) {
-    git_oid treeId;
     if (0 != git_oid_fromstr(&treeId, source.c_str())) {
       cerr << "Fails to convert a hex string into object ID" << endl;
       return false;
     }
-
-    tree = getTree(&treeId);
-    if (tree == nullptr) {
-      return false;
-    }
   }
 
   return createTreeUsingGitTree(
-      id, unique_ptr<git_tree>(tree), addedFiles, deletedFiles);
+      id, source.empty() ? nullptr : &treeId, addedFiles, deletedFiles);
 }
 
 git_commit* Repository::getHeadCommit() {
@@ -158,98 +587,853 @@ git_commit* Repository::getHeadCommit() {
   return getCommit(target);
 }
 
-bool Repository::createTreeUsingCommit(
-    git_oid* id,
-    const string& commit,
-    const unordered_map<std::string, git_oid*>& addedFiles,
-    const unordered_set<std::string>& deletedFiles) {
-  const git_oid* target = nullptr;
-  unique_ptr<git_commit> c;
+/**
+ Compare two tree entries in the order of git trees, where the name of a
+ tree sorts as if it ended with '/'. nullptr sorts after every entry.
+*/
+int compareEntries(const git_tree_entry* a, const git_tree_entry* b) {
+  if (a == nullptr || b == nullptr) {
+    return (a == nullptr) - (b == nullptr);
+  }
+  const char* nameA = git_tree_entry_name(a);
+  const char* nameB = git_tree_entry_name(b);
+  size_t i = 0;
+  while (nameA[i] != '\0' && nameA[i] == nameB[i]) {
+    ++i;
+  }
+  unsigned char ca = nameA[i];
+  unsigned char cb = nameB[i];
+  if (ca == '\0' && git_tree_entry_type(a) == GIT_OBJ_TREE) {
+    ca = '/';
+  }
+  if (cb == '\0' && git_tree_entry_type(b) == GIT_OBJ_TREE) {
+    cb = '/';
+  }
+  return (int) ca - (int) cb;
+}
 
-  if (!commit.empty()) {
-    // Get the object ID for the commit.
-    git_oid commitId;
-    if (0 != git_oid_fromstr(&commitId, commit.c_str())) {
-      cerr << "Fails to convert a hex string into object ID" << endl;
-      return false;
+/**
+ Add the changes between two trees of @param repo to @param changes.
+
+ @param a, b the trees to compare. nullptr is an empty tree.
+ @param path the path of the trees, ending with '/' unless it is empty.
+        It is restored before returning.
+*/
+bool diffSubtrees(
+    git_repository* repo,
+    const git_tree* a,
+    const git_tree* b,
+    string* path,
+    vector<TreeChange>* changes) {
+  size_t countA = a ? git_tree_entrycount(a) : 0;
+  size_t countB = b ? git_tree_entrycount(b) : 0;
+  size_t pathSize = path->size();
+  size_t i = 0, j = 0;
+  while (i < countA || j < countB) {
+    auto ea = (i < countA ? git_tree_entry_byindex(a, i) : nullptr);
+    auto eb = (j < countB ? git_tree_entry_byindex(b, j) : nullptr);
+    int cmp = compareEntries(ea, eb);
+    if (cmp < 0) {
+      eb = nullptr;
+      ++i;
+    } else if (cmp > 0) {
+      ea = nullptr;
+      ++j;
     } else {
-      c.reset(getCommit(&commitId));
-    }
-    if (c.get() == nullptr) {
-      throw runtime_error("Fails to get commit");
+      ++i;
+      ++j;
+      // Identical subtrees and files, whatever their size.
+      if (git_oid_equal(git_tree_entry_id(ea), git_tree_entry_id(eb)) &&
+          git_tree_entry_filemode(ea) == git_tree_entry_filemode(eb)) {
+        continue;
+      }
     }
-  } else {
-    c.reset(getHeadCommit());
-  }
 
-  git_tree* tmpTree = nullptr;
-  if (c.get() != nullptr) {
-    if (0 != git_commit_tree(&tmpTree, c.get())) {
-      throw runtime_error("Fails to get existing tree");
+    path->resize(pathSize);
+    *path += git_tree_entry_name(ea ? ea : eb);
+    bool treeA = (ea && git_tree_entry_type(ea) == GIT_OBJ_TREE);
+    bool treeB = (eb && git_tree_entry_type(eb) == GIT_OBJ_TREE);
+    if (treeA || treeB) {
+      // Both are trees, or one side has none, as names of trees and
+      // files don't match.
+      git_tree* tmpA = nullptr;
+      git_tree* tmpB = nullptr;
+      if ((ea && 0 != git_tree_lookup(&tmpA, repo, git_tree_entry_id(ea))) ||
+          (eb && 0 != git_tree_lookup(&tmpB, repo, git_tree_entry_id(eb)))) {
+        git_tree_free(tmpA);
+        return false;
+      }
+      unique_ptr<git_tree> subtreeA(tmpA), subtreeB(tmpB);
+      *path += '/';
+      if (!diffSubtrees(repo, subtreeA.get(), subtreeB.get(), path,
+                        changes)) {
+        return false;
+      }
+      continue;
     }
-  }
-
-  return createTreeUsingGitTree(
-      id, unique_ptr<git_tree>(tmpTree), addedFiles, deletedFiles);
-}
 
-git_treebuilder* Repository::createTreeBuilder(const git_tree* source) {
-  git_treebuilder* out = nullptr;
-  if (0 == git_treebuilder_new(&out, repo_, source)) {
-    return out;
-  } else {
-    return nullptr;
+    TreeChange change;
+    change.type = !ea ? TreeChange::Added :
+        (!eb ? TreeChange::Deleted : TreeChange::Modified);
+    change.path = *path;
+    memset(&change.oldId, 0, sizeof(change.oldId));
+    memset(&change.newId, 0, sizeof(change.newId));
+    change.oldMode = GIT_FILEMODE_UNREADABLE;
+    change.newMode = GIT_FILEMODE_UNREADABLE;
+    if (ea) {
+      git_oid_cpy(&change.oldId, git_tree_entry_id(ea));
+      change.oldMode = git_tree_entry_filemode(ea);
+    }
+    if (eb) {
+      git_oid_cpy(&change.newId, git_tree_entry_id(eb));
+      change.newMode = git_tree_entry_filemode(eb);
+    }
+    changes->push_back(std::move(change));
   }
+  path->resize(pathSize);
+  return true;
 }
 
-git_tree* Repository::getTree(const git_oid* id) {
-  git_tree* out = nullptr;
-  if (0 == git_tree_lookup(&out, repo_, id)) {
-    return out;
-  } else {
-    return nullptr;
+bool Repository::diffTrees(
+    const string& a,
+    const string& b,
+    vector<TreeChange>* changes) {
+  unique_ptr<git_tree> treeA(getCommitTree(a));
+  unique_ptr<git_tree> treeB(getCommitTree(b));
+  if (treeA.get() == nullptr || treeB.get() == nullptr) {
+    return false;
   }
+  string path;
+  path.reserve(256);
+  return diffSubtrees(repo_, treeA.get(), treeB.get(), &path, changes);
 }
 
-bool Repository::createBlobFromDisk(const std::string& path, git_oid* id) {
-  return (0 == git_blob_create_fromdisk(id, repo_, path.c_str()));
-}
+/**
+ Check whether @param path is the same in two trees, reading only the
+ trees along the path until they are the same.
 
-bool Repository::commit(
-    git_oid* id,
-    const string& updateRef,
-    const string& authorName,
-    const string& authorEmail,
-    const string& message,
-    const git_tree *tree,
-    size_t parentCount,
-    const git_commit *parents[]) {
-  git_signature* sig = nullptr;
-  if (0 != git_signature_now(&sig, authorName.c_str(), authorEmail.c_str())) {
-    return false;
+ @param a, b the object IDs of the trees. nullptr is no tree at all.
+ @param same set to true if the path has the same object ID in both, or
+        is in neither.
+ @returns false if a tree can't be read.
+*/
+bool samePathId(
+    git_repository* repo,
+    const git_oid* a,
+    const git_oid* b,
+    const string& path,
+    bool* same) {
+  git_oid idA, idB;
+  bool hasA = (a != nullptr), hasB = (b != nullptr);
+  if (a) {
+    git_oid_cpy(&idA, a);
+  }
+  if (b) {
+    git_oid_cpy(&idB, b);
+  }
+  bool treeA = true, treeB = true;
+  size_t begin = 0;
+  while (true) {
+    if (!hasA && !hasB) {
+      *same = true;
+      return true;
+    }
+    if (hasA && hasB && git_oid_equal(&idA, &idB)) {
+      *same = true;
+      return true;
+    }
+    if (begin >= path.size()) {
+      *same = false;
+      return true;
+    }
+    size_t end = path.find('/', begin);
+    if (end == string::npos) {
+      end = path.size();
+    }
+    string name = path.substr(begin, end - begin);
+    begin = end + 1;
+
+    // Files have no path below them.
+    for (auto side : {make_tuple(&idA, &hasA, &treeA),
+                      make_tuple(&idB, &hasB, &treeB)}) {
+      git_oid* id = get<0>(side);
+      bool* has = get<1>(side);
+      bool* isTree = get<2>(side);
+      if (!*has) {
+        continue;
+      }
+      if (!*isTree) {
+        *has = false;
+        continue;
+      }
+      git_tree* tmp = nullptr;
+      if (0 != git_tree_lookup(&tmp, repo, id)) {
+        return false;
+      }
+      unique_ptr<git_tree> tree(tmp);
+      auto entry = git_tree_entry_byname(tree.get(), name.c_str());
+      *has = (entry != nullptr);
+      if (entry) {
+        git_oid_cpy(id, git_tree_entry_id(entry));
+        *isTree = (git_tree_entry_type(entry) == GIT_OBJ_TREE);
+      }
+    }
   }
-  int ret = git_commit_create(
-                id,
-                repo_,
-                updateRef.empty() ? nullptr : updateRef.c_str(),
-                sig, /*const gitsignature* author*/
-                sig, /*const gitsignature* committer*/
-                nullptr, /*const char* message_encoding*/
-                message.c_str(),
-                tree,
-                parentCount,
-                parents);
-
-  git_signature_free(sig);
-  return (ret == 0);
 }
 
-git_reference* Repository::getHead() {
-  git_reference* out = nullptr;
-  if (0 == git_repository_head(&out, repo_)) {
-    return out;
-  } else {
-    return nullptr;
+/**
+ Check whether a commit of @param from reaches @param target through
+ parents of the same second @param time. Commits of the same second are
+ the only ones that the time of commits may put after their parents.
+*/
+bool reachesInSecond(
+    git_repository* repo,
+    const vector<git_oid>& from,
+    const git_oid* target,
+    git_time_t time,
+    bool* reaches) {
+  unordered_set<string> seen;
+  vector<git_oid> stack(from);
+  *reaches = false;
+  while (!stack.empty()) {
+    git_oid id = stack.back();
+    stack.pop_back();
+    if (git_oid_equal(&id, target)) {
+      *reaches = true;
+      return true;
+    }
+    if (!seen.insert(oidKey(&id)).second) {
+      continue;
+    }
+    git_commit* tmp = nullptr;
+    if (0 != git_commit_lookup(&tmp, repo, &id)) {
+      return false;
+    }
+    unique_ptr<git_commit> c(tmp);
+    if (git_commit_time(c.get()) != time) {
+      continue;
+    }
+    for (size_t i = 0; i < git_commit_parentcount(c.get()); ++i) {
+      stack.push_back(*git_commit_parent_id(c.get(), i));
+    }
+  }
+  return true;
+}
+
+bool Repository::walkHistory(
+    const string& commit,
+    const string& path,
+    bool firstParent,
+    size_t limit,
+    const function<bool(const git_commit*)>& visit) {
+  git_oid start;
+  if (!resolveCommit(commit, &start)) {
+    // An empty history has nothing to visit.
+    return commit.empty();
+  }
+  string p = path;
+  while (!p.empty() && p.back() == '/') {
+    p.pop_back();
+  }
+
+  // Commits are read as the walk goes, newest first, instead of sorting
+  // the whole history before the first one as a sorted revwalk does.
+  // Along the first parent, only one commit is queued at a time.
+  struct Queued {
+    git_time_t time;
+    // The order commits were found in, to break ties.
+    size_t seq;
+    git_oid id;
+  };
+  auto later = [](const Queued& a, const Queued& b) {
+    return a.time != b.time ? a.time < b.time : a.seq > b.seq;
+  };
+  priority_queue<Queued, vector<Queued>, decltype(later)> queue(later);
+  unordered_set<string> seen;
+  size_t seq = 0;
+  {
+    unique_ptr<git_commit> c(getCommit(&start));
+    if (c.get() == nullptr) {
+      return false;
+    }
+    queue.push(Queued{git_commit_time(c.get()), seq++, start});
+    seen.insert(oidKey(&start));
+  }
+
+  size_t visited = 0;
+  while (visited < limit && !queue.empty()) {
+    Queued next = queue.top();
+    queue.pop();
+    // Commits of the same second come before those they reach, so that
+    // children are still visited before their parents.
+    if (!queue.empty() && queue.top().time == next.time) {
+      vector<Queued> same = {next};
+      while (!queue.empty() && queue.top().time == next.time) {
+        same.push_back(queue.top());
+        queue.pop();
+      }
+      size_t pick = 0;
+      for (; pick + 1 < same.size(); ++pick) {
+        vector<git_oid> others;
+        for (size_t i = 0; i < same.size(); ++i) {
+          if (i != pick) {
+            others.push_back(same[i].id);
+          }
+        }
+        bool reached = false;
+        if (!reachesInSecond(repo_, others, &same[pick].id, next.time,
+                             &reached)) {
+          return false;
+        }
+        if (!reached) {
+          break;
+        }
+      }
+      next = same[pick];
+      for (size_t i = 0; i < same.size(); ++i) {
+        if (i != pick) {
+          queue.push(same[i]);
+        }
+      }
+    }
+
+    unique_ptr<git_commit> c(getCommit(&next.id));
+    if (c.get() == nullptr) {
+      return false;
+    }
+    size_t count = git_commit_parentcount(c.get());
+    if (firstParent && count > 1) {
+      count = 1;
+    }
+    vector<unique_ptr<git_commit>> parents;
+    for (size_t i = 0; i < count; ++i) {
+      auto id = git_commit_parent_id(c.get(), i);
+      parents.emplace_back(getCommit(id));
+      if (parents.back().get() == nullptr) {
+        return false;
+      }
+      if (seen.insert(oidKey(id)).second) {
+        queue.push(Queued{git_commit_time(parents.back().get()), seq++, *id});
+      }
+    }
+
+    // The commit changes the path if it differs from every parent. Root
+    // commits add it.
+    bool changed = true;
+    for (size_t i = 0; changed && i < max<size_t>(count, 1); ++i) {
+      bool same = false;
+      if (!samePathId(repo_, git_commit_tree_id(c.get()),
+                      count > 0 ? git_commit_tree_id(parents[i].get())
+                                : nullptr,
+                      p, &same)) {
+        return false;
+      }
+      changed = !same;
+    }
+    if (!changed) {
+      continue;
+    }
+    ++visited;
+    if (!visit(c.get())) {
+      break;
+    }
+  }
+  return true;
+}
+
+void Repository::useHistoryIndex() {
+  if (!history_) {
+    history_.reset(
+        new HistoryIndex(string(git_repository_path(repo_)) + "history"));
+  }
+}
+
+bool Repository::rebuildHistoryIndex(const string& commit) {
+  useHistoryIndex();
+  history_->clear();
+  git_oid start;
+  if (!resolveCommit(commit, &start)) {
+    // An empty history has nothing to index.
+    return commit.empty();
+  }
+
+  git_revwalk* tmpWalk = nullptr;
+  if (0 != git_revwalk_new(&tmpWalk, repo_)) {
+    return false;
+  }
+  unique_ptr<git_revwalk> walk(tmpWalk);
+  // Oldest first, so that lookups list the newest commits first.
+  git_revwalk_sorting(walk.get(), GIT_SORT_TOPOLOGICAL | GIT_SORT_REVERSE);
+  if (0 != git_revwalk_push(walk.get(), &start)) {
+    return false;
+  }
+  git_oid id;
+  while (0 == git_revwalk_next(&id, walk.get())) {
+    unique_ptr<git_commit> c(getCommit(&id));
+    if (c.get() == nullptr) {
+      return false;
+    }
+    unique_ptr<git_commit> parent;
+    if (git_commit_parentcount(c.get()) > 0) {
+      parent.reset(getCommit(git_commit_parent_id(c.get(), 0)));
+      if (parent.get() == nullptr) {
+        return false;
+      }
+    }
+    if (!indexCommit(&id,
+                     parent ? git_commit_tree_id(parent.get()) : nullptr,
+                     git_commit_tree_id(c.get()))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Repository::historyOf(
+    const string& path,
+    size_t limit,
+    const function<bool(const git_oid*)>& visit) {
+  if (!history_) {
+    return false;
+  }
+  string p = path;
+  while (!p.empty() && p.back() == '/') {
+    p.pop_back();
+  }
+  return history_->find(p, limit, visit);
+}
+
+vector<pair<git_oid, Repository::Unlanded>> Repository::takeUnlanded(
+    const git_oid* tip,
+    const git_oid* old) {
+  vector<pair<git_oid, Unlanded>> ret;
+  git_oid id = *tip;
+  while (old == nullptr || !git_oid_equal(&id, old)) {
+    auto it = unlanded_.find(oidKey(&id));
+    if (it == unlanded_.end()) {
+      break;
+    }
+    ret.emplace_back(id, std::move(it->second));
+    unlandedOrder_.erase(ret.back().second.seq);
+    unlanded_.erase(it);
+    if (!ret.back().second.hasParent) {
+      break;
+    }
+    id = ret.back().second.parent;
+  }
+  reverse(ret.begin(), ret.end());
+  return ret;
+}
+
+Repository::Unlanded& Repository::addUnlanded(const git_oid* id) {
+  string key = oidKey(id);
+  auto it = unlanded_.find(key);
+  if (it != unlanded_.end()) {
+    unlandedOrder_.erase(it->second.seq);
+  } else {
+    // Commits that never land, such as those of references moved by
+    // others, are forgotten after a while.
+    while (unlanded_.size() >= maxUnlanded) {
+      unlanded_.erase(unlandedOrder_.begin()->second);
+      unlandedOrder_.erase(unlandedOrder_.begin());
+    }
+    it = unlanded_.emplace(key, Unlanded()).first;
+  }
+  it->second = Unlanded();
+  it->second.seq = unlandedSeq_++;
+  unlandedOrder_[it->second.seq] = key;
+  return it->second;
+}
+
+void Repository::dropUnlanded(uint64_t seq) {
+  unordered_set<string> keep;
+  for (auto& p : pendingRefs_) {
+    auto it = unlanded_.find(oidKey(&p.second.id));
+    while (it != unlanded_.end() && keep.insert(it->first).second &&
+           it->second.hasParent) {
+      it = unlanded_.find(oidKey(&it->second.parent));
+    }
+  }
+  for (auto it = unlandedOrder_.begin();
+       it != unlandedOrder_.end() && it->first < seq;) {
+    if (keep.count(it->second)) {
+      ++it;
+      continue;
+    }
+    unlanded_.erase(it->second);
+    it = unlandedOrder_.erase(it);
+  }
+}
+
+void Repository::land(const git_oid* tip, const git_oid* old) {
+  auto landed = takeUnlanded(tip, old);
+  if (!landed.empty()) {
+    dropUnlanded(landed.front().second.seq);
+  }
+  for (auto& p : landed) {
+    auto& u = p.second;
+    // Blobs of a branch are not pruned by git gc, unlike those of
+    // commits that never landed.
+    for (auto& blob : u.blobs) {
+      knownBlobs_->insert(&blob);
+    }
+    // The reference moved already, and the index can be rebuilt.
+    if (history_ &&
+        !indexCommit(&p.first, u.hasParent ? &u.parentTree : nullptr,
+                     &u.tree)) {
+      cerr << "Fails to index the history of a commit" << endl;
+    }
+  }
+}
+
+bool Repository::indexCommit(
+    const git_oid* id,
+    const git_oid* parentTree,
+    const git_oid* tree) {
+  unique_ptr<git_tree> a(parentTree ? getTree(parentTree) : nullptr);
+  unique_ptr<git_tree> b(getTree(tree));
+  if ((parentTree && a.get() == nullptr) || b.get() == nullptr) {
+    return false;
+  }
+  vector<TreeChange> changes;
+  string path;
+  if (!diffSubtrees(repo_, a.get(), b.get(), &path, &changes)) {
+    return false;
+  }
+  if (changes.empty()) {
+    return true;
+  }
+
+  // Each changed file, the folders above it, and the root.
+  vector<string> paths(1);
+  unordered_set<string> seen(paths.begin(), paths.end());
+  for (auto& change : changes) {
+    string p = std::move(change.path);
+    while (seen.insert(p).second) {
+      paths.push_back(p);
+      size_t slash = p.rfind('/');
+      p.resize(slash == string::npos ? 0 : slash);
+    }
+  }
+  return history_->add(id, paths);
+}
+
+int Repository::updateReference(
+    const string& refName,
+    const git_oid* id,
+    const git_oid* old,
+    const string& logMessage) {
+  string name = resolveReferenceName(refName);
+  if (mempack_) {
+    // Check the update against what the reference will point to once
+    // the batch is written.
+    git_oid current;
+    bool exists = readReference(name, &current);
+    if (old == nullptr ? exists : !exists || !git_oid_equal(&current, old)) {
+      takeUnlanded(id, old);
+      return exists ? GIT_EMODIFIED : GIT_ENOTFOUND;
+    }
+    auto it = pendingRefs_.find(name);
+    if (it == pendingRefs_.end()) {
+      it = pendingRefs_.emplace(name, PendingRef()).first;
+      it->second.hasOld = (old != nullptr);
+      if (old != nullptr) {
+        git_oid_cpy(&it->second.old, old);
+      }
+    }
+    git_oid_cpy(&it->second.id, id);
+    it->second.steps.emplace_back(*id, logMessage);
+    return 0;
+  }
+
+  // With group durability the objects are synced before the reference is
+  // moved to them.
+  bool group = (durability_ == Durability::Group);
+  if (group && !syncGroup()) {
+    return GIT_ERROR;
+  }
+  git_reference* out = nullptr;
+  int ret = git_reference_create_matching(
+      &out,
+      repo_,
+      name.c_str(),
+      id,
+      old != nullptr ? 1 : 0,
+      old,
+      logMessage.c_str());
+  if (ret != 0) {
+    // The commits are left for a retry to build again.
+    takeUnlanded(id, old);
+    return ret;
+  }
+  git_reference_free(out);
+  land(id, old);
+  // The reference moved, so a failed sync is not the failure of the
+  // update.
+  if (group && !syncGroup()) {
+    cerr << "Fails to sync " << name << endl;
+  }
+  return 0;
+}
+
+bool Repository::readReference(const string& refName, git_oid* out) {
+  return resolveTip(refName, out);
+}
+
+bool Repository::resolveTip(const string& refName, git_oid* out) {
+  if (!pendingRefs_.empty()) {
+    auto it = pendingRefs_.find(resolveReferenceName(refName));
+    if (it != pendingRefs_.end()) {
+      git_oid_cpy(out, &it->second.id);
+      return true;
+    }
+  }
+  int ret = git_reference_name_to_id(out, repo_, refName.c_str());
+  // If there is no HEAD yet, it is the first commit in the repository.
+  if (ret == GIT_ENOTFOUND) {
+    tips_.erase(refName);
+    return false;
+  }
+  if (ret != 0) {
+    throw runtime_error("Fails to resolve " + refName);
+  }
+  auto it = tips_.find(refName);
+  if (it != tips_.end() && git_oid_equal(&it->second.commit, out)) {
+    return true;
+  }
+
+  // The reference was moved by someone else, or is read for the first
+  // time.
+  unique_ptr<git_commit> c(getCommit(out));
+  if (c.get() == nullptr) {
+    throw runtime_error("Expect a commit object");
+  }
+  tips_[refName] = Tip{*out, *git_commit_tree_id(c.get())};
+  return true;
+}
+
+bool Repository::getTreeOf(const git_oid* commit, git_oid* out) {
+  if (git_oid_equal(commit, &lastCommit_.commit)) {
+    git_oid_cpy(out, &lastCommit_.tree);
+    return true;
+  }
+  for (auto& p : tips_) {
+    if (git_oid_equal(commit, &p.second.commit)) {
+      git_oid_cpy(out, &p.second.tree);
+      return true;
+    }
+  }
+  unique_ptr<git_commit> c(getCommit(commit));
+  if (c.get() == nullptr) {
+    return false;
+  }
+  git_oid_cpy(out, git_commit_tree_id(c.get()));
+  return true;
+}
+
+bool Repository::createTreeUsingCommit(
+    git_oid* id,
+    const string& commit,
+    const unordered_map<std::string, git_oid*>& addedFiles,
+    const unordered_set<std::string>& deletedFiles) {
+  const git_oid* target = nullptr;
+  unique_ptr<git_commit> c;
+
+  if (!commit.empty()) {
+    // Get the object ID for the commit.
+    git_oid commitId;
+    if (0 != git_oid_fromstr(&commitId, commit.c_str())) {
+      cerr << "Fails to convert a hex string into object ID" << endl;
+      return false;
+    } else {
+      c.reset(getCommit(&commitId));
+    }
+    if (c.get() == nullptr) {
+      throw runtime_error("Fails to get commit");
+    }
+  } else {
+    c.reset(getHeadCommit());
+  }
+
+  // The tree itself is looked up later, unless it is cached.
+  const git_oid* treeId = nullptr;
+  if (c.get() != nullptr) {
+    treeId = git_commit_tree_id(c.get());
+    if (treeId == nullptr) {
+      throw runtime_error("Fails to get existing tree");
+    }
+  }
+
+  return createTreeUsingGitTree(id, treeId, addedFiles, deletedFiles);
+}
+
+git_treebuilder* Repository::createTreeBuilder(const git_tree* source) {
+  git_treebuilder* out = nullptr;
+  if (0 == git_treebuilder_new(&out, repo_, source)) {
+    return out;
+  } else {
+    return nullptr;
+  }
+}
+
+git_tree* Repository::getTree(const git_oid* id) {
+  git_tree* out = nullptr;
+  if (0 == git_tree_lookup(&out, repo_, id)) {
+    return out;
+  } else {
+    return nullptr;
+  }
+}
+
+bool Repository::createBlobFromDisk(const std::string& path, git_oid* id) {
+  return (0 == git_blob_create_fromdisk(id, repo_, path.c_str()));
+}
+
+bool Repository::createBlobFromBuffer(const std::string& data, git_oid* id) {
+  return (0 == git_blob_create_frombuffer(
+                   id, repo_, data.data(), data.size()));
+}
+
+git_odb_stream* Repository::createBlobStream(uint64_t size) {
+  unique_ptr<git_odb> odb(getOdb());
+  if (odb.get() == nullptr) {
+    return nullptr;
+  }
+  git_odb_stream* out = nullptr;
+  if (0 == git_odb_open_wstream(&out, odb.get(), size, GIT_OBJ_BLOB)) {
+    return out;
+  } else {
+    return nullptr;
+  }
+}
+
+bool Repository::createBlobFromFd(int fd, git_oid* id) {
+  struct stat st;
+  if (0 != fstat(fd, &st)) {
+    return false;
+  }
+
+  auto stream = createBlobStream(st.st_size);
+  if (stream == nullptr) {
+    return false;
+  }
+  BlobWriter w(stream);
+
+  vector<char> buf(blobChunkSize);
+  for (;;) {
+    auto n = read(fd, buf.data(), buf.size());
+    if (n < 0) {
+      return false;
+    } else if (n == 0) {
+      break;
+    }
+    if (!w.write(buf.data(), n)) {
+      return false;
+    }
+  }
+  return w.finalize(id);
+}
+
+bool Repository::createBlobFromStream(istream& in, git_oid* id) {
+  vector<char> buf(blobChunkSize);
+
+  // Find out the size of the stream if it is seekable.
+  auto start = in.tellg();
+  if (start != istream::pos_type(-1) && in.seekg(0, ios::end)) {
+    auto size = in.tellg() - start;
+    in.seekg(start);
+
+    auto stream = createBlobStream(size);
+    if (stream == nullptr) {
+      return false;
+    }
+    BlobWriter w(stream);
+    while (in) {
+      in.read(buf.data(), buf.size());
+      if (in.gcount() > 0 && !w.write(buf.data(), in.gcount())) {
+        return false;
+      }
+    }
+    return in.eof() && w.finalize(id);
+  }
+
+  // Not seekable, let libgit2 spool the contents to a temporary file.
+  in.clear();
+  git_writestream* stream = nullptr;
+  if (0 != git_blob_create_fromstream(&stream, repo_, nullptr)) {
+    return false;
+  }
+  while (in) {
+    in.read(buf.data(), buf.size());
+    if (in.gcount() > 0 &&
+        0 != stream->write(stream, buf.data(), in.gcount())) {
+      stream->free(stream);
+      return false;
+    }
+  }
+  if (!in.eof()) {
+    stream->free(stream);
+    return false;
+  }
+  // The stream is freed by the commit call.
+  return (0 == git_blob_create_fromstream_commit(id, stream));
+}
+
+bool Repository::commit(
+    git_oid* id,
+    const string& updateRef,
+    const string& authorName,
+    const string& authorEmail,
+    const string& message,
+    const git_tree *tree,
+    size_t parentCount,
+    const git_commit *parents[]) {
+  git_signature* sig = nullptr;
+  if (0 != git_signature_now(&sig, authorName.c_str(), authorEmail.c_str())) {
+    return false;
+  }
+  int ret = git_commit_create(
+                id,
+                repo_,
+                nullptr, /*const char* update_ref*/
+                sig, /*const gitsignature* author*/
+                sig, /*const gitsignature* committer*/
+                nullptr, /*const char* message_encoding*/
+                message.c_str(),
+                tree,
+                parentCount,
+                parents);
+
+  git_signature_free(sig);
+  if (ret != 0) {
+    return false;
+  }
+  if (history_) {
+    Unlanded& u = addUnlanded(id);
+    u.hasParent = (parentCount > 0);
+    if (parentCount > 0) {
+      git_oid_cpy(&u.parent, git_commit_id(parents[0]));
+      git_oid_cpy(&u.parentTree, git_commit_tree_id(parents[0]));
+    }
+    git_oid_cpy(&u.tree, git_tree_id(tree));
+  }
+  if (!updateRef.empty() &&
+      0 != updateReference(
+               updateRef, id,
+               parentCount > 0 ? git_commit_id(parents[0]) : nullptr,
+               commitLogMessage(message, parentCount == 0))) {
+    cerr << "Fails to update " << updateRef << endl;
+    return false;
+  }
+  return true;
+}
+
+git_reference* Repository::getHead() {
+  git_reference* out = nullptr;
+  if (0 == git_repository_head(&out, repo_)) {
+    return out;
+  } else {
+    return nullptr;
   }
 }
 
@@ -271,6 +1455,151 @@ git_commit* Repository::getCommit(const git_oid* id) {
   }
 }
 
+bool Repository::resolveCommit(const string& commit, git_oid* out) {
+  if (commit.empty()) {
+    return resolveTip("HEAD", out);
+  }
+  if (0 != git_oid_fromstr(out, commit.c_str())) {
+    cerr << "Invalid commit " << commit << endl;
+    return false;
+  }
+  return true;
+}
+
+git_tree* Repository::getCommitTree(const string& commit) {
+  git_oid commitId;
+  if (!resolveCommit(commit, &commitId)) {
+    return nullptr;
+  }
+
+  // Cached tips give the tree without reading the commit.
+  git_oid treeId;
+  git_tree* out = nullptr;
+  if (!getTreeOf(&commitId, &treeId) ||
+      0 != git_tree_lookup(&out, repo_, &treeId)) {
+    return nullptr;
+  }
+  return out;
+}
+
+BlobHandle Repository::readFile(const string& commit, const string& path) {
+  unique_ptr<git_tree> tree(getCommitTree(commit));
+  if (tree.get() == nullptr) {
+    return BlobHandle();
+  }
+
+  git_tree_entry* tmpEntry = nullptr;
+  if (0 != git_tree_entry_bypath(&tmpEntry, tree.get(), path.c_str())) {
+    return BlobHandle();
+  }
+  unique_ptr<git_tree_entry> entry(tmpEntry);
+  // Submodules have no blob.
+  if (git_tree_entry_type(entry.get()) != GIT_OBJ_BLOB) {
+    return BlobHandle();
+  }
+
+  git_blob* blob = nullptr;
+  if (0 != git_blob_lookup(&blob, repo_, git_tree_entry_id(entry.get()))) {
+    return BlobHandle();
+  }
+  return BlobHandle(blob);
+}
+
+vector<BlobHandle> Repository::readFiles(
+    const string& commit,
+    const vector<string>& paths) {
+  vector<BlobHandle> ret(paths.size());
+  unique_ptr<git_tree> root(getCommitTree(commit));
+  if (root.get() == nullptr) {
+    return ret;
+  }
+
+  // Sorted paths visit the files of a folder one after another.
+  vector<size_t> order(paths.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  sort(order.begin(), order.end(), [&paths](size_t a, size_t b) {
+    return paths[a] < paths[b];
+  });
+
+  // The trees from the root to the current folder, and their paths
+  // ending with '/'. The root is not owned here.
+  vector<git_tree*> trees = { root.get() };
+  vector<string> dirs = { string() };
+  vector<unique_ptr<git_tree>> subtrees;
+
+  vector<git_oid> ids(paths.size());
+  vector<bool> found(paths.size(), false);
+  for (size_t i : order) {
+    const string& path = paths[i];
+    size_t slash = path.rfind('/');
+    size_t dirSize = (slash == string::npos ? 0 : slash + 1);
+
+    // Go up to a folder containing the path, then down to its own folder.
+    while (path.compare(0, dirs.back().size(), dirs.back()) != 0 ||
+           dirs.back().size() > dirSize) {
+      trees.pop_back();
+      dirs.pop_back();
+      subtrees.pop_back();
+    }
+    bool ok = true;
+    while (ok && dirs.back().size() < dirSize) {
+      size_t begin = dirs.back().size();
+      size_t end = path.find('/', begin);
+      string name = path.substr(begin, end - begin);
+      auto entry = git_tree_entry_byname(trees.back(), name.c_str());
+      git_tree* subtree = nullptr;
+      ok = (entry != nullptr &&
+            git_tree_entry_type(entry) == GIT_OBJ_TREE &&
+            0 == git_tree_lookup(&subtree, repo_, git_tree_entry_id(entry)));
+      if (ok) {
+        subtrees.emplace_back(subtree);
+        trees.push_back(subtree);
+        dirs.push_back(path.substr(0, end + 1));
+      }
+    }
+    if (!ok) {
+      continue;
+    }
+    auto entry = git_tree_entry_byname(trees.back(),
+                                       path.c_str() + dirSize);
+    if (entry != nullptr && git_tree_entry_type(entry) == GIT_OBJ_BLOB) {
+      git_oid_cpy(&ids[i], git_tree_entry_id(entry));
+      found[i] = true;
+    }
+  }
+
+  auto read = [&](Repository* handle, size_t i) {
+    git_blob* blob = nullptr;
+    if (found[i] && 0 == git_blob_lookup(&blob, handle->repo_, &ids[i])) {
+      ret[i] = BlobHandle(blob);
+    }
+  };
+
+  // Workers can't read the in-memory backend of a batch.
+  if (!pool_ || mempack_ || paths.size() < parallelMinReads) {
+    for (size_t i = 0; i < paths.size(); ++i) {
+      read(this, i);
+    }
+    return ret;
+  }
+
+  // Each worker inflates its share of the blobs through its own object
+  // database.
+  vector<future<void>> done;
+  for (size_t w = 0; w < workers_.size(); ++w) {
+    auto worker = workers_[w].get();
+    done.push_back(pool_->submit([&, w, worker] {
+      for (size_t i = w; i < paths.size(); i += workers_.size()) {
+        read(worker, i);
+      }
+    }));
+  }
+  waitAll(done);
+  return ret;
+}
+
 git_remote* Repository::getRemote(const string& name) {
   git_remote* out = nullptr;
   if (0 == git_remote_lookup(&out, repo_, name.c_str())) {
@@ -280,276 +1609,535 @@ git_remote* Repository::getRemote(const string& name) {
   }
 }
 
-git_repository* Repository::release() {
-  auto ret = repo_;
-  repo_ = nullptr;
-  return ret;
+void Repository::setTreeCacheSize(size_t size) {
+  treeCache_->setCapacity(size);
 }
 
-string joinFilePath(const vector<string>& parts, int start, int end) {
-  stringstream ss;
-  for (int i = start; i < end; ++i) {
-    ss << parts[i];
-    if (i < end - 1) {
-      ss << "/";
-    } else {
-      break;
+void Repository::setParallelism(size_t threads) {
+  pool_.reset();
+  workers_.clear();
+  if (threads <= 1) {
+    return;
+  }
+
+  string path = git_repository_path(repo_);
+  unique_ptr<git_odb> odb(logSegmentSize_ > 0 ? getOdb() : nullptr);
+  for (size_t i = 0; i < threads; ++i) {
+    workers_.emplace_back(new Repository(path));
+    // Workers count as Strict handles of their own.
+    workers_.back()->setDurability(durability_);
+    if (odb) {
+      git_repository_set_odb(workers_.back()->repo_, odb.get());
+    } else if (compression_) {
+      workers_.back()->setCompressionPolicy(*compression_);
     }
   }
-  return ss.str();
+  pool_.reset(new ThreadPool(threads));
 }
 
-git_treebuilder* getTreeBuilder(
-    unordered_map<string, unique_ptr<git_treebuilder>>* builderMap,
-    git_repository* repo,
-    const string& path,
-    const git_tree* ptree) {
-  auto it = builderMap->find(path);
-  if (it != builderMap->end()) {
-    return it->second.get();
+void Repository::beginBatch(size_t maxBytes, chrono::milliseconds maxAge) {
+  if (!mempack_) {
+    resetOdb(true);
   }
-  git_treebuilder* out = nullptr;
-  if (0 != git_treebuilder_new(&out, repo, ptree)) {
-    throw runtime_error("Fails to create a new treebuilder");
-  }
-  (*builderMap)[path] = unique_ptr<git_treebuilder>(out);
-  return out;
+  batchMaxBytes_ = maxBytes;
+  batchMaxAge_ = maxAge;
+  batchBytes_ = 0;
+  batchStart_ = chrono::steady_clock::now();
 }
 
-bool Repository::createTreeUsingGitTree(
-    git_oid* idOut,
-    unique_ptr<git_tree> tree,
-    const unordered_map<string, git_oid*>& addedFiles,
-    const unordered_set<string>& deletedFiles) {
-  // Collect all files that is going to be updated.
-  vector<string> affectedFiles;
-  for (auto& p : addedFiles) {
-    affectedFiles.push_back(p.first);
-  }
-  for (auto& s : deletedFiles) {
-    affectedFiles.push_back(s);
-  }
-
-  // Maps a prefix to a pair. A prefix is the relative path of a directory.
-  // For a relative file path of "a/b/c/d", prefixes are "a", "a/b",
-  // "a/b/c", base file name is "d".
-  //
-  // The map has all prefixes for a given file. The base name, however,
-  // only appears in the value field of the longest prefix.
-  //
-  // The first field of the pair are a list of base file names that has
-  // been changed in the prefix directory.
-  //
-  // The second field is the corresponding git_tree's position in
-  // @param queue, or -1 if the tree is a new one. Initially all second
-  // fields are -1.
-  map<string, pair<vector<string>, int>> changeTreeMap;
-  for (auto& s : affectedFiles) {
-    vector<string> parts = splitFilePath(s);
-    if (parts.empty()) {
-      cerr << "An empty string cannot be a valid path name" << endl;
-      return false;
+bool Repository::flushBatch() {
+  if (!mempack_) {
+    return true;
+  }
+
+  git_buf pack = {nullptr, 0, 0};
+  if (0 != git_mempack_dump(&pack, repo_, mempack_)) {
+    cerr << "Fails to pack the objects of the batch" << endl;
+    return false;
+  }
+
+  // An empty pack has only its header and trailer.
+  bool ok = (pack.size <= packOverhead);
+  if (!ok) {
+    unique_ptr<git_odb> odb(getOdb());
+    git_odb_writepack* w = nullptr;
+    if (odb.get() != nullptr &&
+        0 == git_odb_write_pack(&w, odb.get(), nullptr, nullptr)) {
+      git_transfer_progress progress = {0};
+      ok = (0 == w->append(w, pack.ptr, pack.size, &progress) &&
+            0 == w->commit(w, &progress));
+      w->free(w);
     }
+  }
+  git_buf_free(&pack);
 
-    string name = parts.back();
-    parts.pop_back();
+  if (!ok) {
+    cerr << "Fails to write the pack of the batch" << endl;
+    return false;
+  }
+  git_mempack_reset(mempack_);
+  batchBytes_ = 0;
+  batchStart_ = chrono::steady_clock::now();
 
-    for (int i = parts.size(); i >= 0; --i) {
-      // Allow empty string to be returned.
-      auto prefix = joinFilePath(parts, 0, i);
-      if (i == parts.size()) {
-        changeTreeMap[prefix].first.push_back(name);
-        changeTreeMap[prefix].second = -1;
-      } else if (changeTreeMap.count(prefix) == 0) {
-        changeTreeMap[prefix] = make_pair(vector<string>(), -1);
-      } else {
+  // References are moved once the objects they point to are written.
+  if (durability_ == Durability::Group && !syncGroup()) {
+    return false;
+  }
+  for (auto& p : pendingRefs_) {
+    auto& ref = p.second;
+    // The reference moves once per batched commit, so that each commit
+    // gets its own reflog entry, as it would without a batch.
+    const git_oid* old = ref.hasOld ? &ref.old : nullptr;
+    const git_oid* at = old;
+    bool moved = true;
+    for (auto& step : ref.steps) {
+      git_reference* out = nullptr;
+      if (0 != git_reference_create_matching(
+                   &out,
+                   repo_,
+                   p.first.c_str(),
+                   &step.first,
+                   at != nullptr ? 1 : 0,
+                   at,
+                   step.second.c_str())) {
+        moved = false;
         break;
       }
+      git_reference_free(out);
+      at = &step.first;
     }
+    if (at != old) {
+      land(at, old);
+    }
+    if (!moved) {
+      cerr << "Fails to update " << p.first << endl;
+      takeUnlanded(&ref.id, at);
+      ok = false;
+    }
+  }
+  pendingRefs_.clear();
+  // The objects are written, even if a reference couldn't be moved.
+  // flushRefs() syncs references kept in memory itself.
+  ok = flushRefs() && ok;
+  if (!refdb_ && durability_ == Durability::Group && !syncGroup()) {
+    return false;
   }
+  return ok;
+}
 
-  // For the special key "", we know its git_tree's position in
-  // @param queue is 0.
-  {
-    auto it = changeTreeMap.find("");
-    if (it != changeTreeMap.end()) {
-      it->second.second = 0;
+bool Repository::endBatch() {
+  if (!mempack_) {
+    return true;
+  }
+  if (!flushBatch()) {
+    return false;
+  }
+  resetOdb(false);
+  return true;
+}
+
+void Repository::resetOdb(bool inMemory) {
+  // A new object database leaves the one of other handles sharing it,
+  // such as those of a RepositoryPool, untouched.
+  git_odb* tmp = nullptr;
+  string objects = string(git_repository_path(repo_)) + "objects";
+  if (0 != git_odb_open(&tmp, objects.c_str())) {
+    throw runtime_error("Fails to open the object database");
+  }
+  unique_ptr<git_odb> odb(tmp);
+  // Objects known to the old database may not be in the new one.
+  knownBlobs_->clear();
+
+  git_odb_backend* backend = nullptr;
+  if (inMemory) {
+    // Higher priority than the loose and packed backends, so that new
+    // objects are written to it.
+    if (0 != git_mempack_new(&backend) ||
+        0 != git_odb_add_backend(odb.get(), backend, mempackPriority)) {
+      throw runtime_error("Fails to add an in-memory object backend");
+    }
+  }
+  if (compression_) {
+    // Loose objects are still read by the default loose backend.
+    git_odb_backend* compressed =
+        createCompressionBackend(objects, *compression_,
+                                 durability_ == Durability::Strict);
+    if (0 != git_odb_add_backend(odb.get(), compressed,
+                                 compressionPriority)) {
+      compressed->free(compressed);
+      throw runtime_error("Fails to add the compression object backend");
     }
   }
+  if (logSegmentSize_ > 0) {
+    git_odb_backend* log = createLogBackend(
+        string(git_repository_path(repo_)) + "objects/log", logSegmentSize_,
+        durability_ == Durability::Strict);
+    if (0 != git_odb_add_backend(odb.get(), log, logPriority)) {
+      log->free(log);
+      throw runtime_error("Fails to add the log object backend");
+    }
+  }
+  if (0 != git_repository_set_odb(repo_, odb.get())) {
+    throw runtime_error("Fails to set the object database");
+  }
+  mempack_ = backend;
 
-  // Defines the fields used in the tuple below.
-  enum {
-    // The position in the queue that holds the parent entry.
-    parent = 0,
-    // The (relative) path of the git_tree.
-    rel_path,
-    // Pointer to the corresponding git_tree.
-    tree_ptr,
-  };
+  // Only one backend may use the log, so workers share this database.
+  if (logSegmentSize_ > 0) {
+    for (auto& w : workers_) {
+      git_repository_set_odb(w->repo_, odb.get());
+    }
+  }
+}
 
-  // A queue (actually a stack) that helps WFS search of sub-trees.
-  // Each element of the queue is a tuple whose elements is defined
-  // in the enum above.
-  vector<tuple<int, string, unique_ptr<git_tree>>> queue;
-  queue.push_back(make_tuple(-1, string(), std::move(tree)));
-
-  // A width-first traverse to find all sub-trees that are affected
-  // by the update.
-  for (int pos = 0; pos < queue.size(); ++pos) {
-    git_tree* ptree = std::get<tree_ptr>(queue[pos]).get();
-    int entrycount = 0;
-    if (ptree) {
-      entrycount = git_tree_entrycount(ptree);
-    }
-
-    // Find sub-trees of current node.
-    for (int i = 0; i < entrycount; ++i) {
-      auto entry = git_tree_entry_byindex(ptree, i);
-      if (entry == nullptr) {
-        cerr << "Entry should not be null" << endl;
-        return false;
-      }
+void Repository::setCompressionPolicy(const CompressionPolicy& policy) {
+  if (mempack_ && !flushBatch()) {
+    throw runtime_error("Fails to flush the batch");
+  }
+  compression_.reset(new CompressionPolicy(policy));
+  resetOdb(mempack_ != nullptr);
+  if (logSegmentSize_ == 0) {
+    for (auto& w : workers_) {
+      w->setCompressionPolicy(policy);
+    }
+  }
+}
 
-      git_otype otype = git_tree_entry_type(entry);
-      if (otype == GIT_OBJ_TREE) {
-        // Figure out the correct key for @param changeTreeMap.
-        const char* base = git_tree_entry_name(entry);
-        const auto& relPath = std::get<rel_path>(queue[pos]);
-        string name;
-        if (!relPath.empty()) {
-          name = relPath + "/" + base;
-        } else {
-          name = base;
-        }
+void Repository::useLogBackend(size_t maxSegmentSize) {
+  if (mempack_ && !flushBatch()) {
+    throw runtime_error("Fails to flush the batch");
+  }
+  logSegmentSize_ = maxSegmentSize;
+  resetOdb(mempack_ != nullptr);
+}
 
-        auto it = changeTreeMap.find(name);
-
-        // We only interested in affected paths.
-        if (it != changeTreeMap.end()) {
-          const git_oid* id = git_tree_entry_id(entry);
-          git_tree* child = nullptr;
-          if (0 != git_tree_lookup(&child, repo_, id)) {
-            cerr << "Fails to lookup a tree id" << endl;
-            return false;
-          } else {
-            it->second.second = queue.size();
-            queue.emplace_back(pos, name, unique_ptr<git_tree>(child));
-          }
-        }
-      }
+void Repository::useMemoryRefdb(size_t batchSize) {
+  if (refdb_) {
+    return;
+  }
+  git_refdb* tmp = nullptr;
+  if (0 != git_refdb_new(&tmp, repo_)) {
+    throw runtime_error("Fails to create a reference database");
+  }
+  unique_ptr<git_refdb> refdb(tmp);
+  git_refdb_backend* backend = createMemoryRefdb(
+      repo_, batchSize, durability_ == Durability::Strict);
+  if (backend == nullptr) {
+    throw runtime_error("Fails to create the in-memory reference backend");
+  }
+  if (0 != git_refdb_set_backend(refdb.get(), backend)) {
+    backend->free(backend);
+    throw runtime_error("Fails to set the reference backend");
+  }
+  if (0 != git_repository_set_refdb(repo_, refdb.get())) {
+    throw runtime_error("Fails to set the reference database");
+  }
+  refdb_ = backend;
+}
+
+bool Repository::flushRefs() {
+  if (!refdb_) {
+    return true;
+  }
+  if (0 != flushMemoryRefdb(refdb_)) {
+    cerr << "Fails to write the references" << endl;
+    return false;
+  }
+  return durability_ != Durability::Group || syncGroup();
+}
+
+void Repository::setDurability(Durability durability) {
+  if (mempack_ && !flushBatch()) {
+    throw runtime_error("Fails to flush the batch");
+  }
+  if ((durability == Durability::Strict) !=
+      (durability_ == Durability::Strict)) {
+    holdStrict(durability == Durability::Strict);
+  }
+  durability_ = durability;
+  // Backends of this library sync their own writes.
+  if (compression_ || logSegmentSize_ > 0) {
+    resetOdb(mempack_ != nullptr);
+  }
+  if (refdb_) {
+    setMemoryRefdbSync(refdb_, durability == Durability::Strict);
+  }
+  if (logSegmentSize_ == 0) {
+    for (auto& w : workers_) {
+      w->setDurability(durability);
     }
   }
+}
 
-  // Find all entries in the changeTreeMap that has not be touched yet.
-  for (auto& p : changeTreeMap) {
-    if (p.second.second < 0) {
-      string prefix;
-      auto pos = p.first.rfind('/');
-      if (pos != string::npos) {
-        prefix = string(p.first, 0, pos);
-      }
-      auto it = changeTreeMap.find(prefix);
-      if (it == changeTreeMap.end()) {
-        throw runtime_error("Fails to find prefix " + prefix);
-      }
-      p.second.second = queue.size();
-      queue.emplace_back(it->second.second, p.first, nullptr);
+bool Repository::syncGroup() {
+  // One sync for all the files written since the last one, whichever
+  // backend wrote them.
+  int fd = open(git_repository_path(repo_), O_RDONLY | O_DIRECTORY);
+  bool ok = (fd >= 0 && 0 == syncfs(fd));
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (!ok) {
+    cerr << "Fails to sync " << git_repository_path(repo_) << endl;
+  }
+  return ok;
+}
+
+string Repository::resolveReferenceName(const string& name) {
+  string ret = name;
+  // Symbolic references are rarely chained, but they may be.
+  for (int depth = 0; depth < 5; ++depth) {
+    git_reference* out = nullptr;
+    if (0 != git_reference_lookup(&out, repo_, ret.c_str())) {
+      break;
+    }
+    unique_ptr<git_reference> ref(out);
+    auto target = git_reference_symbolic_target(ref.get());
+    if (target == nullptr) {
+      break;
     }
+    ret = target;
   }
+  return ret;
+}
 
-  // Work backward to create new trees without dependency.
-  unordered_map<string, unique_ptr<git_treebuilder>> builderMap;
-  for (int i = queue.size() - 1; i >= 0; --i) {
-    const string& name = std::get<rel_path>(queue[i]);
-    bool removeCurrentTree = false;
+git_repository* Repository::release() {
+  auto ret = repo_;
+  repo_ = nullptr;
+  return ret;
+}
 
-    // Object ID of current tree, to be filled later.
-    git_oid id;
+/**
+ Obtain the treebuilder of a tree, from the cache if possible.
 
-    // Update current tree, inserts or remove files as requested.
-    {
-      // Test the difference between addition and deletion. If deletions
-      // outnumber additions, there is a chance that the directory (tree)
-      // should be removed.
-      int diff = 0;
-
-      // Obtain current tree's git_treebuilder.
-      const git_tree* ptree = std::get<tree_ptr>(queue[i]).get();
-      git_treebuilder* b = getTreeBuilder(&builderMap, repo_, name, ptree);
-
-      // Find out if there is any changes (files updates) for current tree.
-      auto it = changeTreeMap.find(name);
-      if (it != changeTreeMap.end()) {
-        for (auto& s : it->second.first) {
-          auto path = name.empty() ? s : name + "/" + s;
-          auto found = addedFiles.find(path);
-          if (found != addedFiles.end()) {
-            ++diff;
-            const git_tree_entry* out = nullptr;
-            auto mode = (git_filemode_t)0100644;
-            git_treebuilder_insert(&out, b, s.c_str(), found->second, mode);
-          } else if (deletedFiles.count(path) > 0) {
-            --diff;
-            git_treebuilder_remove(b, s.c_str());
-          }
-        }
-      }
+ @param source the object ID of the existing tree, or nullptr if the tree
+        is a new one.
+ @param path the relative path of the tree.
+*/
+unique_ptr<git_treebuilder> loadTreeBuilder(
+    git_repository* repo,
+    TreeCache* cache,
+    const git_oid* source,
+    const string& path) {
+  unique_ptr<git_treebuilder> b;
+  if (source != nullptr) {
+    b = cache->take(path, source);
+    if (b) {
+      return b;
+    }
+  }
 
-      // Test if current tree should be removed.
-      // TODO: verify that git_treebuilder_entrycount is working as intended.
-      if (diff < 0 && git_treebuilder_entrycount(b) == 0) {
-        removeCurrentTree = true;
-      }
+  unique_ptr<git_tree> tree;
+  if (source != nullptr) {
+    git_tree* t = nullptr;
+    if (0 != git_tree_lookup(&t, repo, source)) {
+      throw runtime_error("Fails to lookup a tree id");
+    }
+    tree.reset(t);
+  }
+  git_treebuilder* out = nullptr;
+  if (0 != git_treebuilder_new(&out, repo, tree.get())) {
+    throw runtime_error("Fails to create a new treebuilder");
+  }
+  b.reset(out);
+  return b;
+}
 
-      // Finalize and create a new tree.
-      if (!removeCurrentTree) {
-        if (0 != git_treebuilder_write(&id, b)) {
-          throw runtime_error("Fails to create a new tree object");
-        }
-      }
+// Get the object ID of the existing sub-tree @param name in a tree, or
+// nullptr if there is none. A file of the same name does not count, it
+// will be replaced by the new directory.
+const git_oid* getSubTreeId(git_treebuilder* b, const char* name) {
+  auto entry = git_treebuilder_get(b, name);
+  if (entry != nullptr && git_tree_entry_type(entry) == GIT_OBJ_TREE) {
+    return git_tree_entry_id(entry);
+  }
+  return nullptr;
+}
+
+// A sub-tree built ahead of its parent, see updateTree.
+struct SubTree {
+  // True if the sub-tree is kept, false if it becomes empty.
+  bool kept;
+  // The object ID of the new sub-tree.
+  git_oid id;
+  // The number of trees written for it, itself included.
+  size_t written = 0;
+};
+
+/**
+ Update a tree with the changes under a node of the change set, bottom-up,
+ and write the new tree to the object database.
+
+ @param b the tree's treebuilder, see loadTreeBuilder.
+ @param path the relative path of the tree. The string is also used as
+        a buffer for the paths of sub-trees, and is restored on return.
+ @param id the object ID of the new tree, if the method returns true.
+ @param written incremented for each tree written.
+ @param built if not null, the node's sub-directories have been built
+        already, in this order, and are not visited again.
+ @returns false if the tree becomes empty and should be removed.
+*/
+bool updateTree(
+    git_repository* repo,
+    TreeCache* cache,
+    const ChangeSet::Node* node,
+    unique_ptr<git_treebuilder> b,
+    string* path,
+    git_oid* id,
+    size_t* written,
+    const vector<SubTree>* built = nullptr) {
+  auto len = path->size();
+  size_t subTrees = 0;
+  for (auto c = node->firstChild; c != nullptr; c = c->nextSibling) {
+    // The child's path. Its base name, NUL terminated, is at the end.
+    if (len > 0) {
+      path->push_back('/');
     }
+    path->append(c->name.data(), c->name.size());
+    const char* name = path->c_str() + path->size() - c->name.size();
 
-    // Update parent.
-    if (i > 0) {
-      // Obtain parent's relative path.
-      string prefix, base;
-      auto pos = name.rfind('/');
-      if (pos != string::npos) {
-        prefix = string(name, 0, pos);
-        base = name.substr(pos+1);
+    if (c->isFile) {
+      if (c->id != nullptr) {
+        const git_tree_entry* out = nullptr;
+        auto mode = (git_filemode_t)0100644;
+        git_treebuilder_insert(&out, b.get(), name, c->id, mode);
       } else {
-        base = name;
+        git_treebuilder_remove(b.get(), name);
       }
-
-      // Obtain the treebuilder for the parent.
-      auto parentIdx = std::get<parent>(queue[i]);
-      const git_tree* ptree = nullptr;
-
-      if (parentIdx >= 0) {
-        ptree = std::get<tree_ptr>(queue[parentIdx]).get();
+    } else {
+      SubTree child;
+      if (built != nullptr) {
+        child = (*built)[subTrees++];
+        *written += child.written;
+      } else {
+        auto childBuilder = loadTreeBuilder(
+            repo, cache, getSubTreeId(b.get(), name), *path);
+        child.kept = updateTree(
+            repo, cache, c, std::move(childBuilder), path, &child.id,
+            written);
+        // The buffer may have been reallocated by the sub-tree.
+        name = path->c_str() + path->size() - c->name.size();
       }
 
-      git_treebuilder* b = getTreeBuilder(&builderMap, repo_, prefix, ptree);
-
-      // Update the treebuilder.
-      if (!removeCurrentTree) {
+      if (child.kept) {
         const git_tree_entry* out = nullptr;
         auto mode = (git_filemode_t)0040000;
-        git_treebuilder_insert(&out, b, base.c_str(), &id, mode);
+        git_treebuilder_insert(&out, b.get(), name, &child.id, mode);
       } else {
-        git_treebuilder_remove(b, base.c_str());
+        git_treebuilder_remove(b.get(), name);
       }
-    } else {
-      // This is the last iteration in the loop.
-      if (removeCurrentTree) {
-        // The repo becomes empty. No tree object ID shall be returned.
-        return false;
-      } else {
-        git_oid_cpy(idOut, &id);
+    }
+
+    path->resize(len);
+  }
+
+  // Test if current tree should be removed.
+  if (node->firstChild != nullptr && git_treebuilder_entrycount(b.get()) == 0) {
+    return false;
+  }
+
+  // Finalize and create a new tree, and keep it for the next commit.
+  if (0 != git_treebuilder_write(id, b.get())) {
+    throw runtime_error("Fails to create a new tree object");
+  }
+  ++*written;
+  cache->put(*path, id, std::move(b));
+  return true;
+}
+
+bool Repository::createTreeUsingGitTree(
+    git_oid* idOut,
+    const git_oid* source,
+    const unordered_map<string, git_oid*>& addedFiles,
+    const unordered_set<string>& deletedFiles) {
+  // Plan the update. Only the directories with changes are visited, and
+  // only their changed entries are looked up.
+  ChangeSet changes;
+  if (!changes.build(addedFiles, deletedFiles)) {
+    cerr << "An empty string cannot be a valid path name" << endl;
+    return false;
+  }
+
+  // Make sure the original tree exists.
+  if (source != nullptr && !treeCache_->contains("", source)) {
+    unique_ptr<git_tree> tree(getTree(source));
+    if (tree.get() == nullptr) {
+      cerr << "Fails to lookup a tree id" << endl;
+      return false;
+    }
+    unique_ptr<git_treebuilder> b(createTreeBuilder(tree.get()));
+    if (!b) {
+      throw runtime_error("Fails to create a new treebuilder");
+    }
+    treeCache_->put("", source, std::move(b));
+  }
+  auto root = loadTreeBuilder(repo_, treeCache_.get(), source, "");
+
+  // The sub-directories of the root with changes.
+  vector<const ChangeSet::Node*> dirs;
+  for (auto c = changes.root()->firstChild; c != nullptr; c = c->nextSibling) {
+    if (!c->isFile) {
+      dirs.push_back(c);
+    }
+  }
+
+  // Build the sub-trees of the root on the workers for large commits.
+  // Each worker owns a separate repository handle and tree cache, and a
+  // directory always goes to the same worker so its cache stays warm.
+  // The root's entries end up the same, so the result is identical to
+  // building serially.
+  vector<SubTree> built;
+  if (pool_ && !mempack_ && dirs.size() > 1 &&
+      changes.fileCount() >= parallelMinFiles) {
+    built.resize(dirs.size());
+
+    // Names of the directories, NUL terminated, and their existing trees.
+    vector<string> names(dirs.size());
+    vector<git_oid> sources(dirs.size());
+    vector<char> exists(dirs.size());
+    vector<vector<size_t>> assigned(workers_.size());
+    for (size_t i = 0; i < dirs.size(); ++i) {
+      names[i].assign(dirs[i]->name.data(), dirs[i]->name.size());
+      auto id = getSubTreeId(root.get(), names[i].c_str());
+      if (id != nullptr) {
+        git_oid_cpy(&sources[i], id);
       }
+      exists[i] = (id != nullptr);
+      assigned[hash<string>()(names[i]) % workers_.size()].push_back(i);
     }
+
+    vector<future<void>> done;
+    for (size_t w = 0; w < workers_.size(); ++w) {
+      if (assigned[w].empty()) {
+        continue;
+      }
+      auto worker = workers_[w].get();
+      auto& indexes = assigned[w];
+      done.push_back(pool_->submit([&, worker] {
+        string path;
+        for (auto i : indexes) {
+          path = names[i];
+          auto b = loadTreeBuilder(
+              worker->repo_, worker->treeCache_.get(),
+              exists[i] ? &sources[i] : nullptr, path);
+          built[i].kept = updateTree(
+              worker->repo_, worker->treeCache_.get(), dirs[i],
+              std::move(b), &path, &built[i].id, &built[i].written);
+        }
+      }));
+    }
+
+    waitAll(done);
   }
 
+  // Work bottom-up from the root.
+  string path;
+  if (!updateTree(repo_, treeCache_.get(), changes.root(), std::move(root),
+                  &path, idOut, &stats_.treesWritten,
+                  built.empty() ? nullptr : &built)) {
+    // The repo becomes empty. No tree object ID shall be returned.
+    return false;
+  }
   return true;
 }
 
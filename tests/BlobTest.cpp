@@ -0,0 +1,317 @@
+#include "Wrapper.h"
+#include "TestUtils.h"
+
+#include <stdexcept>
+#include <sstream>
+#include <string>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+using namespace std;
+using namespace libgit2pp;
+
+const string root("/tmp/testBlob");
+
+// Build contents that span multiple streaming chunks.
+string makeContents() {
+  stringstream ss;
+  for (int i = 0; i < 50000; ++i) {
+    ss << "line " << i << "\n";
+  }
+  return ss.str();
+}
+
+void testStreamBlob() {
+  setupRoot(root);
+
+  // Initializing libgit2 library.
+  Git2 git2;
+
+  // Create a bare repository.
+  unique_ptr<Repository> r;
+  try {
+    r = make_unique<Repository>(root, true);
+  } catch (const exception& ex) {
+    throw runtime_error("Fails to create a new git repository");
+  }
+
+  auto data = makeContents();
+
+  // The expected object ID, from the in-memory path.
+  git_oid expected;
+  if (!r->createBlobFromBuffer(data, &expected)) {
+    throw runtime_error("Fails to create a blob from buffer");
+  }
+
+  // Write the blob in chunks.
+  {
+    auto stream = r->createBlobStream(data.size());
+    if (stream == nullptr) {
+      throw runtime_error("Fails to open a blob stream");
+    }
+    BlobWriter w(stream);
+    for (size_t pos = 0; pos < data.size(); pos += 1000) {
+      auto len = min<size_t>(1000, data.size() - pos);
+      if (!w.write(data.data() + pos, len)) {
+        throw runtime_error("Fails to write a chunk");
+      }
+    }
+    git_oid id;
+    if (!w.finalize(&id) || 0 != git_oid_cmp(&id, &expected)) {
+      throw runtime_error("Expect the streamed blob to match");
+    }
+  }
+
+  // Write the blob from a file descriptor.
+  {
+    auto tmppath = root + "/tmpfile";
+    writeToFile(tmppath, data);
+    int fd = open(tmppath.c_str(), O_RDONLY);
+    git_oid id;
+    bool ok = r->createBlobFromFd(fd, &id);
+    close(fd);
+    unlink(tmppath.c_str());
+    if (!ok || 0 != git_oid_cmp(&id, &expected)) {
+      throw runtime_error("Expect the blob from fd to match");
+    }
+  }
+
+  // Write the blob from an input stream.
+  {
+    istringstream in(data);
+    git_oid id;
+    if (!r->createBlobFromStream(in, &id) ||
+        0 != git_oid_cmp(&id, &expected)) {
+      throw runtime_error("Expect the blob from istream to match");
+    }
+  }
+}
+
+// Size of the loose object file of @param id.
+off_t looseSize(const git_oid* id) {
+  char hex[GIT_OID_HEXSZ + 1];
+  git_oid_tostr(hex, sizeof(hex), id);
+  struct stat st;
+  string path = root + "/objects/" + string(hex, 2) + "/" + (hex + 2);
+  if (0 != stat(path.c_str(), &st)) {
+    throw runtime_error("Expect a loose object at " + path);
+  }
+  return st.st_size;
+}
+
+void testCompressionPolicy() {
+  setupRoot(root);
+
+  // Initializing libgit2 library.
+  Git2 git2;
+
+  // Create a bare repository.
+  unique_ptr<Repository> r;
+  try {
+    r = make_unique<Repository>(root, true);
+  } catch (const exception& ex) {
+    throw runtime_error("Fails to create a new git repository");
+  }
+
+  CompressionPolicy policy;
+  policy.blobLevel = 9;
+  r->setCompressionPolicy(policy);
+
+  // Text is compressed, random bytes are stored.
+  string text = makeContents();
+  string noise(100000, 0);
+  mt19937 mt(1);
+  for (auto& c : noise) {
+    c = (char) mt();
+  }
+  git_oid textId, noiseId;
+  if (!r->createBlobFromBuffer(text, &textId) ||
+      !r->createBlobFromBuffer(noise, &noiseId)) {
+    throw runtime_error("Fails to create a blob from buffer");
+  }
+  if (looseSize(&textId) * 3 > (off_t) text.size()) {
+    throw runtime_error("Expect text to be compressed");
+  }
+  if (looseSize(&noiseId) < (off_t) noise.size()) {
+    throw runtime_error("Expect random bytes to be stored");
+  }
+
+  // Both read back as written.
+  for (auto p : { make_pair(&textId, &text), make_pair(&noiseId, &noise) }) {
+    git_blob* blob = nullptr;
+    if (0 != git_blob_lookup(&blob, r->get(), p.first)) {
+      throw runtime_error("Fails to read a blob");
+    }
+    string data(static_cast<const char*>(git_blob_rawcontent(blob)),
+                git_blob_rawsize(blob));
+    git_blob_free(blob);
+    if (data != *p.second) {
+      throw runtime_error("Expect a blob to read back as written");
+    }
+  }
+}
+
+void testReadFile() {
+  setupRoot(root);
+
+  // Initializing libgit2 library.
+  Git2 git2;
+
+  // Create a bare repository.
+  unique_ptr<Repository> r;
+  try {
+    r = make_unique<Repository>(root, true);
+  } catch (const exception& ex) {
+    throw runtime_error("Fails to create a new git repository");
+  }
+  if (r->readFile("", "a/b")) {
+    throw runtime_error("Expect no file before the first commit");
+  }
+
+  string contents = makeContents();
+  unordered_map<string, string> addedFiles = {
+    {"a/b", contents}, {"a/c", "c"}
+  };
+  string first = r->commit(
+      "HEAD", "My Name", "my.name@gmail.com", "A testing commit",
+      addedFiles, unordered_set<string>());
+  addedFiles = { {"a/b", "changed"} };
+  string second = r->commit(
+      "HEAD", "My Name", "my.name@gmail.com", "A testing commit",
+      addedFiles, unordered_set<string>());
+  if (first.empty() || second.empty()) {
+    throw runtime_error("Fails to create a commit");
+  }
+
+  BlobHandle head = r->readFile("", "a/b");
+  BlobHandle old = r->readFile(first, "a/b");
+  if (!head || head.contents() != "changed" ||
+      !old || old.contents() != contents) {
+    throw runtime_error("Expect to read files from commits");
+  }
+  // The contents are those of the blob itself.
+  if (old.contents().data() != git_blob_rawcontent(old.get())) {
+    throw runtime_error("Expect contents not to be copied");
+  }
+  if (r->readFile(second, "a/c").contents() != "c") {
+    throw runtime_error("Expect to read unchanged files");
+  }
+  if (r->readFile(second, "a") || r->readFile(second, "a/d") ||
+      r->readFile(string(GIT_OID_HEXSZ, '0'), "a/b")) {
+    throw runtime_error("Expect only files to be read");
+  }
+}
+
+void testReadFiles() {
+  setupRoot(root);
+
+  // Initializing libgit2 library.
+  Git2 git2;
+
+  // Create a bare repository.
+  unique_ptr<Repository> r;
+  try {
+    r = make_unique<Repository>(root, true);
+  } catch (const exception& ex) {
+    throw runtime_error("Fails to create a new git repository");
+  }
+
+  unordered_map<string, string> addedFiles;
+  vector<string> paths;
+  for (int i = 0; i < 60; ++i) {
+    string path = "d" + to_string(i % 3) + "/e" + to_string(i % 4) + "/f" +
+        to_string(i);
+    addedFiles[path] = path;
+    paths.push_back(path);
+  }
+  addedFiles["top"] = "top";
+  string id = r->commit(
+      "HEAD", "My Name", "my.name@gmail.com", "A testing commit",
+      addedFiles, unordered_set<string>());
+  if (id.empty()) {
+    throw runtime_error("Fails to create a commit");
+  }
+  // Files at the top, duplicates, folders and missing files.
+  paths.insert(paths.begin(), "top");
+  paths.push_back("d1/e1/f1");
+  paths.push_back("d1/e1");
+  paths.push_back("d1/e9/f1");
+  paths.push_back("d1/e1/f1/g");
+
+  for (size_t threads : {1, 3}) {
+    r->setParallelism(threads);
+    auto blobs = r->readFiles(id, paths);
+    if (blobs.size() != paths.size()) {
+      throw runtime_error("Expect a blob for each path");
+    }
+    for (size_t i = 0; i < paths.size(); ++i) {
+      auto it = addedFiles.find(paths[i]);
+      if (it == addedFiles.end() ? (bool) blobs[i] :
+          blobs[i].contents() != it->second) {
+        throw runtime_error("Unexpected contents of " + paths[i]);
+      }
+    }
+    blobs.clear();
+  }
+  r->setParallelism(1);
+}
+
+void testParallelBlobs() {
+  setupRoot(root);
+
+  // Initializing libgit2 library.
+  Git2 git2;
+
+  // Create a bare repository.
+  unique_ptr<Repository> r;
+  try {
+    r = make_unique<Repository>(root, true);
+  } catch (const exception& ex) {
+    throw runtime_error("Fails to create a new git repository");
+  }
+  r->setParallelism(3);
+
+  // More blobs than the workers, some of them the same.
+  unordered_map<string, string> addedFiles;
+  for (int i = 0; i < 20; ++i) {
+    addedFiles["d" + to_string(i % 2) + "/f" + to_string(i)] =
+        "contents " + to_string(i % 15);
+  }
+  string id = r->commit(
+      "HEAD", "My Name", "my.name@gmail.com", "A testing commit",
+      addedFiles, unordered_set<string>());
+  if (id.empty()) {
+    throw runtime_error("Fails to create a commit");
+  }
+  auto& stats = r->getLastCommitStats();
+  if (stats.blobsWritten + stats.blobsDeduplicated != addedFiles.size() ||
+      stats.blobsWritten != 15) {
+    throw runtime_error("Unexpected statistics of parallel blobs");
+  }
+
+  // A new handle reads what the workers wrote.
+  Repository reader(root);
+  for (auto& p : addedFiles) {
+    git_oid expected;
+    git_odb_hash(&expected, p.second.data(), p.second.size(), GIT_OBJ_BLOB);
+    BlobHandle blob = reader.readFile(id, p.first);
+    if (!blob || !git_oid_equal(blob.id(), &expected) ||
+        blob.contents() != p.second) {
+      throw runtime_error("Unexpected blob of " + p.first);
+    }
+  }
+  r->setParallelism(1);
+}
+
+main() {
+  testStreamBlob();
+  testCompressionPolicy();
+  testReadFile();
+  testReadFiles();
+  testParallelBlobs();
+}
@@ -0,0 +1,132 @@
+#include "CommitQueue.h"
+#include "TestUtils.h"
+
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace libgit2pp;
+
+const int threads = 4;
+const int commitsPerThread = 10;
+
+void testCommitQueue() {
+  const string root("/tmp/testCommitQueue");
+  setupRoot(root);
+
+  // Initializing libgit2 library.
+  Git2 git2;
+  unique_ptr<Repository> r;
+
+  try {
+    // Create a bare repository.
+    r.reset(new Repository(root, true));
+  } catch (const exception& ex) {
+    throw runtime_error("Fails to create a new git repository");
+  }
+
+  vector<string> ids(threads * commitsPerThread);
+  {
+    CommitQueue queue(r.get(), "HEAD");
+    vector<thread> writers;
+    for (int t = 0; t < threads; ++t) {
+      writers.emplace_back([&queue, &ids, t] {
+        for (int i = 0; i < commitsPerThread; ++i) {
+          string path = "t" + to_string(t) + "/f" + to_string(i);
+          unordered_map<string, string> addedFiles = { {path, path} };
+          ids[t * commitsPerThread + i] = queue.submit(
+              "My Name",
+              "my.name@gmail.com",
+              "Queued commit " + path,
+              addedFiles,
+              unordered_set<string>()).get();
+        }
+      });
+    }
+    for (auto& w : writers) {
+      w.join();
+    }
+  }
+
+  for (auto& id : ids) {
+    if (id.empty()) {
+      throw runtime_error("Fails to create a queued commit");
+    }
+  }
+
+  // Every commit is on the branch, and the last one has all the files.
+  for (int t = 0; t < threads; ++t) {
+    for (int i = 0; i < commitsPerThread; ++i) {
+      string path = "t" + to_string(t) + "/f" + to_string(i);
+      if (blobAt(r.get(), path).empty()) {
+        throw runtime_error("Expect to find " + path);
+      }
+    }
+  }
+
+  unique_ptr<git_reference> head(r->getHead());
+  unique_ptr<git_commit> c(r->getCommit(git_reference_target(head.get())));
+  size_t count = 1;
+  while (git_commit_parentcount(c.get()) > 0) {
+    c.reset(r->getCommit(git_commit_parent_id(c.get(), 0)));
+    ++count;
+  }
+  if (count != ids.size()) {
+    throw runtime_error("Expect one commit per request");
+  }
+}
+
+// Each queued commit gets its own reflog entry, batched or not.
+void testReflog() {
+  const string root("/tmp/testCommitQueueReflog");
+  setupRoot(root);
+  Git2 git2;
+  Repository r(root, false);
+
+  {
+    CommitQueue queue(&r, "HEAD");
+    vector<future<string>> results;
+    for (int i = 0; i < 3; ++i) {
+      unordered_map<string, string> addedFiles = { {"README", to_string(i)} };
+      results.push_back(queue.submit(
+          "My Name",
+          "my.name@gmail.com",
+          "Queued commit " + to_string(i) + "\n\nWith a body.\n",
+          addedFiles,
+          unordered_set<string>()));
+    }
+    for (auto& result : results) {
+      if (result.get().empty()) {
+        throw runtime_error("Fails to create a queued commit");
+      }
+    }
+  }
+
+  git_reflog* tmp = nullptr;
+  if (0 != git_reflog_read(&tmp, r.get(), "refs/heads/master")) {
+    throw runtime_error("Fails to read the reflog");
+  }
+  unique_ptr<git_reflog, void (*)(git_reflog*)> reflog(tmp, git_reflog_free);
+  vector<string> expected = {
+    "commit: Queued commit 2",
+    "commit: Queued commit 1",
+    "commit (initial): Queued commit 0",
+  };
+  if (git_reflog_entrycount(reflog.get()) != expected.size()) {
+    throw runtime_error("Expect one reflog entry per queued commit");
+  }
+  for (size_t i = 0; i < expected.size(); ++i) {
+    if (expected[i] != git_reflog_entry_message(
+            git_reflog_entry_byindex(reflog.get(), i))) {
+      throw runtime_error("Unexpected reflog message " + expected[i]);
+    }
+  }
+}
+
+main() {
+  testCommitQueue();
+  testReflog();
+}
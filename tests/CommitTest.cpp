@@ -6,6 +6,7 @@
 #include <string>
 #include <memory>
 #include <iostream>
+#include <vector>
 
 #include <unistd.h>
 
@@ -165,7 +166,92 @@ void testMoreCommit() {
   }
 }
 
+string commitFile(Repository* r, const string& path, const string& data) {
+  unordered_map<string, string> addedFiles = { {path, data} };
+  string id = r->commit("HEAD", "My Name", "my.name@gmail.com", path,
+                        addedFiles, unordered_set<string>());
+  if (id.empty()) {
+    throw runtime_error("Fails to create a commit");
+  }
+  return id;
+}
+
+// The messages of the commits walkHistory() visits.
+vector<string> walk(Repository* r, const string& path, bool firstParent,
+                    size_t limit) {
+  vector<string> ret;
+  if (!r->walkHistory("", path, firstParent, limit,
+                      [&ret](const git_commit* c) {
+        ret.push_back(git_commit_message(c));
+        return true;
+      })) {
+    throw runtime_error("Fails to walk the history");
+  }
+  return ret;
+}
+
+void testWalkHistory() {
+  setupRoot(root);
+
+  // Initializing libgit2 library.
+  Git2 git2;
+
+  unique_ptr<Repository> r;
+  try {
+    // Create a bare repository.
+    r.reset(new Repository(root, true));
+  } catch (const exception& ex) {
+    throw runtime_error("Fails to create a new git repository");
+  }
+  if (!walk(r.get(), "a/x", true, 10).empty()) {
+    throw runtime_error("Expect no history before the first commit");
+  }
+
+  commitFile(r.get(), "a/x", "1");
+  commitFile(r.get(), "b/y", "1");
+  string base = commitFile(r.get(), "a/z", "1");
+  commitFile(r.get(), "a/x", "2");
+
+  // A side branch changes a/x, and is merged keeping a/x of HEAD.
+  git_oid side, head, baseId;
+  git_oid_fromstr(&baseId, base.c_str());
+  unordered_map<string, string> addedFiles = { {"a/x", "3"} };
+  if (!r->createCommit(&side, &baseId, "", "My Name", "my.name@gmail.com",
+                       "side", addedFiles, unordered_set<string>()) ||
+      0 != git_reference_name_to_id(&head, r->get(), "HEAD")) {
+    throw runtime_error("Fails to create a side commit");
+  }
+  unique_ptr<git_commit> headCommit(r->getCommit(&head));
+  unique_ptr<git_tree> headTree(r->getCommitTree(""));
+  unique_ptr<git_commit> sideCommit(r->getCommit(&side));
+  const git_commit* parents[] = { headCommit.get(), sideCommit.get() };
+  git_oid merge;
+  if (!r->commit(&merge, "HEAD", "My Name", "my.name@gmail.com", "merge",
+                 headTree.get(), 2, parents)) {
+    throw runtime_error("Fails to merge");
+  }
+  commitFile(r.get(), "b/y", "2");
+
+  if (walk(r.get(), "a/x", true, 10) != vector<string>({"a/x", "a/x"})) {
+    throw runtime_error("Unexpected first-parent history of a/x");
+  }
+  // Commits within the same second still come before their parents, and
+  // the side commit before the base both branches reach.
+  if (walk(r.get(), "a/x", false, 10) !=
+      vector<string>({"a/x", "side", "a/x"})) {
+    throw runtime_error("Unexpected full history of a/x");
+  }
+  if (walk(r.get(), "a/", true, 2) != vector<string>({"a/x", "a/z"})) {
+    throw runtime_error("Unexpected limited history of a");
+  }
+  if (walk(r.get(), "", true, 10).size() != 5 ||
+      !walk(r.get(), "c", false, 10).empty()) {
+    throw runtime_error("Unexpected history of the root");
+  }
+}
+
 main() {
   testFirstCommit();
   testMoreCommit();
+  testWalkHistory();
 }
@@ -0,0 +1,191 @@
+#include "Wrapper.h"
+#include "TestUtils.h"
+
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace std;
+using namespace libgit2pp;
+
+const string root("/tmp/testHistoryIndex");
+
+string commitFile(Repository* r, const string& path, const string& data) {
+  unordered_map<string, string> addedFiles = { {path, data} };
+  string id = r->commit("HEAD", "My Name", "my.name@gmail.com", path,
+                        addedFiles, unordered_set<string>());
+  if (id.empty()) {
+    throw runtime_error("Fails to create a commit");
+  }
+  return id;
+}
+
+// The indexed commits of @param path, newest first.
+vector<string> lookup(Repository* r, const string& path, size_t limit = 100) {
+  vector<string> ret;
+  if (!r->historyOf(path, limit, [&ret](const git_oid* id) {
+        char hex[GIT_OID_HEXSZ + 1];
+        git_oid_tostr(hex, sizeof(hex), id);
+        ret.push_back(hex);
+        return true;
+      })) {
+    throw runtime_error("Fails to read the history index");
+  }
+  return ret;
+}
+
+// The commits walkHistory() visits along the first parent.
+vector<string> walk(Repository* r, const string& path) {
+  vector<string> ret;
+  if (!r->walkHistory("", path, true, 100, [&ret](const git_commit* c) {
+        char hex[GIT_OID_HEXSZ + 1];
+        git_oid_tostr(hex, sizeof(hex), git_commit_id(c));
+        ret.push_back(hex);
+        return true;
+      })) {
+    throw runtime_error("Fails to walk the history");
+  }
+  return ret;
+}
+
+void checkAgainstWalk(Repository* r) {
+  for (auto& path : {"", "a", "a/", "a/x", "a/z", "b", "b/y", "c"}) {
+    if (lookup(r, path) != walk(r, path)) {
+      throw runtime_error(string("Unexpected indexed history of ") + path);
+    }
+  }
+}
+
+void testHistoryIndex() {
+  setupRoot(root);
+
+  // Initializing libgit2 library.
+  Git2 git2;
+
+  vector<string> ids;
+  {
+    Repository r(root, true);
+    r.useHistoryIndex();
+    if (!lookup(&r, "a/x").empty()) {
+      throw runtime_error("Expect an empty index");
+    }
+    ids.push_back(commitFile(&r, "a/x", "1"));
+    ids.push_back(commitFile(&r, "b/y", "1"));
+    ids.push_back(commitFile(&r, "a/z", "1"));
+    ids.push_back(commitFile(&r, "a/x", "2"));
+    // Writing the same contents changes nothing.
+    ids.push_back(commitFile(&r, "a/x", "2"));
+
+    if (lookup(&r, "a/x") != vector<string>({ids[3], ids[0]}) ||
+        lookup(&r, "a") != vector<string>({ids[3], ids[2], ids[0]}) ||
+        lookup(&r, "a/x", 1) != vector<string>({ids[3]}) ||
+        lookup(&r, "").size() != 4 ||
+        !lookup(&r, "c").empty()) {
+      throw runtime_error("Unexpected indexed history");
+    }
+    checkAgainstWalk(&r);
+  }
+
+  // A torn record left by a crash is dropped when the index is opened.
+  {
+    ofstream out(root + "/history/records", ios::app | ios::binary);
+    out << "torn";
+  }
+  {
+    Repository r(root);
+    r.useHistoryIndex();
+    checkAgainstWalk(&r);
+    ids.push_back(commitFile(&r, "b/y", "2"));
+    checkAgainstWalk(&r);
+  }
+
+  // Lost heads are linked again from the records.
+  if (0 != unlink((root + "/history/heads").c_str())) {
+    throw runtime_error("Fails to remove the heads of the index");
+  }
+  {
+    Repository r(root);
+    r.useHistoryIndex();
+    checkAgainstWalk(&r);
+  }
+
+  // Commits of another handle are only indexed by a rebuild.
+  {
+    Repository r(root);
+    commitFile(&r, "a/z", "2");
+    commitFile(&r, "c/w", "1");
+  }
+  {
+    Repository r(root);
+    r.useHistoryIndex();
+    if (!lookup(&r, "c").empty()) {
+      throw runtime_error("Expect no index of other handles' commits");
+    }
+    if (!r.rebuildHistoryIndex("")) {
+      throw runtime_error("Fails to rebuild the history index");
+    }
+    checkAgainstWalk(&r);
+  }
+
+  // Only commits that land on a branch are indexed.
+  {
+    Repository r(root);
+    r.useHistoryIndex();
+    git_oid head, stray;
+    if (!r.readReference("HEAD", &head)) {
+      throw runtime_error("Fails to read HEAD");
+    }
+    unordered_map<string, string> addedFiles = { {"e/f", "1"} };
+    if (!r.createCommit(&stray, &head, "", "My Name", "my.name@gmail.com",
+                        "stray", addedFiles, unordered_set<string>())) {
+      throw runtime_error("Fails to create a commit");
+    }
+    // The base of this commit is not the tip anymore.
+    commitFile(&r, "b/y", "3");
+    char hex[GIT_OID_HEXSZ + 1];
+    git_oid_tostr(hex, sizeof(hex), &head);
+    if (!r.commitMatching(hex, "HEAD", "My Name", "my.name@gmail.com",
+                          "rejected", { {"b/y", "4"} },
+                          unordered_set<string>()).empty()) {
+      throw runtime_error("Expect a conflicting commit to be rejected");
+    }
+    if (!lookup(&r, "e").empty() || lookup(&r, "b/y").size() != 3) {
+      throw runtime_error("Expect no index of commits off the branch");
+    }
+
+    r.beginBatch();
+    string batched = commitFile(&r, "e/g", "1");
+    if (!lookup(&r, "e").empty()) {
+      throw runtime_error("Expect batched commits indexed once written");
+    }
+    if (!r.endBatch() || lookup(&r, "e") != vector<string>({batched})) {
+      throw runtime_error("Expect batched commits indexed once written");
+    }
+    checkAgainstWalk(&r);
+  }
+
+  // The table grows past its initial capacity.
+  {
+    Repository r(root);
+    r.useHistoryIndex();
+    unordered_map<string, string> addedFiles;
+    for (int i = 0; i < 40000; ++i) {
+      addedFiles["g/d" + to_string(i % 100) + "/f" + to_string(i)] = "1";
+    }
+    string id = r.commit("HEAD", "My Name", "my.name@gmail.com", "many",
+                         addedFiles, unordered_set<string>());
+    if (id.empty() ||
+        lookup(&r, "g/d7/f12307") != vector<string>({id}) ||
+        lookup(&r, "g/d99") != vector<string>({id})) {
+      throw runtime_error("Unexpected history after growing the index");
+    }
+    checkAgainstWalk(&r);
+  }
+}
+
+main() {
+  testHistoryIndex();
+}
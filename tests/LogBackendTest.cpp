@@ -0,0 +1,167 @@
+#include "Wrapper.h"
+#include "TestUtils.h"
+
+#include <stdexcept>
+#include <string>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace libgit2pp;
+
+const string root("/tmp/testLogBackend");
+const int commits = 20;
+const int filesPerCommit = 10;
+
+string pathOf(int commit, int i) {
+  return "d" + to_string(i % 3) + "/f" + to_string(commit) + "_" +
+      to_string(i);
+}
+
+string contentsOf(int commit, int i) {
+  return string(1000, 'a' + (commit + i) % 26) + pathOf(commit, i);
+}
+
+unordered_map<string, string> filesOf(int commit) {
+  unordered_map<string, string> ret;
+  for (int i = 0; i < filesPerCommit; ++i) {
+    ret[pathOf(commit, i)] = contentsOf(commit, i);
+  }
+  return ret;
+}
+
+// Every file committed so far must be read back through @param r.
+void checkFiles(Repository* r, int count) {
+  for (int commit = 0; commit < count; ++commit) {
+    for (int i = 0; i < filesPerCommit; ++i) {
+      if (readHeadFile(r, pathOf(commit, i)) != contentsOf(commit, i)) {
+        throw runtime_error("Unexpected contents of " + pathOf(commit, i));
+      }
+    }
+  }
+}
+
+size_t countFiles(const string& path, const string& prefix) {
+  size_t ret = 0;
+  DIR* dir = opendir(path.c_str());
+  while (auto e = readdir(dir)) {
+    ret += (0 == string(e->d_name).compare(0, prefix.size(), prefix));
+  }
+  closedir(dir);
+  return ret;
+}
+
+void testLogBackend() {
+  setupRoot(root);
+
+  // Initializing libgit2 library.
+  Git2 git2;
+
+  {
+    unique_ptr<Repository> r;
+    try {
+      // Create a bare repository.
+      r.reset(new Repository(root, true));
+    } catch (const exception& ex) {
+      throw runtime_error("Fails to create a new git repository");
+    }
+
+    // Small segments, so that the log rolls over.
+    r->useLogBackend(64 * 1024);
+    for (int i = 0; i < commits; ++i) {
+      commitFiles(r.get(), filesOf(i));
+    }
+    checkFiles(r.get(), commits);
+  }
+
+  // No loose objects, and several segments.
+  for (int i = 0; i < 256; ++i) {
+    char dir[3];
+    snprintf(dir, sizeof(dir), "%02x", i);
+    if (0 == access((root + "/objects/" + dir).c_str(), F_OK)) {
+      throw runtime_error("Expect no loose objects");
+    }
+  }
+  if (countFiles(root + "/objects/log", "segment-") < 2) {
+    throw runtime_error("Expect the log to roll over");
+  }
+
+  // The index is reused when the log is opened again.
+  {
+    Repository r(root);
+    r.useLogBackend(64 * 1024);
+    checkFiles(&r, commits);
+  }
+}
+
+// A torn record at the tail and a lost index are recovered from the log.
+void testLogRecovery() {
+  Git2 git2;
+
+  string last;
+  {
+    DIR* dir = opendir((root + "/objects/log").c_str());
+    while (auto e = readdir(dir)) {
+      string name = e->d_name;
+      if (name.compare(0, 8, "segment-") == 0 && name > last) {
+        last = name;
+      }
+    }
+    closedir(dir);
+  }
+  int fd = open((root + "/objects/log/" + last).c_str(), O_WRONLY | O_APPEND);
+  if (fd < 0 || 10 != write(fd, "GOLGtorn..", 10)) {
+    throw runtime_error("Fails to tear the log");
+  }
+  close(fd);
+  unlink((root + "/objects/log/index").c_str());
+
+  Repository r(root);
+  r.useLogBackend(64 * 1024);
+  checkFiles(&r, commits);
+  commitFiles(&r, filesOf(commits));
+  checkFiles(&r, commits + 1);
+}
+
+// A corrupt record in the middle of the log cuts it there, and the
+// segments after it are dropped.
+void testCorruptSegment() {
+  Git2 git2;
+
+  string log = root + "/objects/log/";
+  if (countFiles(log, "segment-") < 3) {
+    throw runtime_error("Expect at least three segments");
+  }
+  // Overwrite the contents of the first record of the second segment.
+  int fd = open((log + "segment-00000002.log").c_str(), O_WRONLY);
+  if (fd < 0 || 4 != pwrite(fd, "bad!", 4, 64)) {
+    throw runtime_error("Fails to corrupt the log");
+  }
+  close(fd);
+  unlink((log + "index").c_str());
+
+  Repository r(root);
+  r.useLogBackend(64 * 1024);
+  if (countFiles(log, "segment-") != 2) {
+    throw runtime_error("Expect the segments after a corrupt one dropped");
+  }
+
+  // The first segment is still there, and new objects are written.
+  unique_ptr<git_odb> odb(r.getOdb());
+  git_oid first, added;
+  string data = contentsOf(0, 0);
+  git_odb_hash(&first, data.data(), data.size(), GIT_OBJ_BLOB);
+  if (!git_odb_exists(odb.get(), &first) ||
+      0 != git_odb_write(&added, odb.get(), "added", 5, GIT_OBJ_BLOB) ||
+      !git_odb_exists(odb.get(), &added)) {
+    throw runtime_error("Expect the log usable after a corrupt segment");
+  }
+}
+
+main() {
+  testLogBackend();
+  testLogRecovery();
+  testCorruptSegment();
+}
@@ -0,0 +1,86 @@
+#include "MaintenanceScheduler.h"
+#include "TestUtils.h"
+
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+using namespace std;
+using namespace libgit2pp;
+
+string pathOf(int commit, int i) {
+  return "d" + to_string(i % 4) + "/f" + to_string(commit) + "_" +
+      to_string(i);
+}
+
+void commitFiles(Repository* r, int commit, int files) {
+  unordered_map<string, string> addedFiles;
+  for (int i = 0; i < files; ++i) {
+    addedFiles[pathOf(commit, i)] = pathOf(commit, i);
+  }
+  commitFiles(r, addedFiles);
+}
+
+// Every file committed must be readable through @param r.
+void checkFiles(Repository* r, int commits, int files) {
+  for (int commit = 0; commit < commits; ++commit) {
+    for (int i = 0; i < files; ++i) {
+      if (readHeadFile(r, pathOf(commit, i)) != pathOf(commit, i)) {
+        throw runtime_error("Unexpected contents of " + pathOf(commit, i));
+      }
+    }
+  }
+}
+
+void testMaintenance() {
+  const string root("/tmp/testMaintenance");
+  setupRoot(root);
+
+  // Initializing libgit2 library.
+  Git2 git2;
+  unique_ptr<Repository> r;
+
+  try {
+    // Create a bare repository.
+    r.reset(new Repository(root, true));
+  } catch (const exception& ex) {
+    throw runtime_error("Fails to create a new git repository");
+  }
+
+  {
+    // Loose objects are packed by the thread once commits wrote enough.
+    MaintenanceScheduler scheduler(r.get(), 100, 3, 1024 * 1024,
+                                   chrono::hours(1));
+    r->setMaintenanceScheduler(&scheduler);
+    for (int i = 0; i < 30; ++i) {
+      commitFiles(r.get(), i, 5);
+    }
+    for (int i = 0; i < 1000 && scheduler.getReport().runs == 0; ++i) {
+      this_thread::sleep_for(chrono::milliseconds(10));
+    }
+    auto report = scheduler.getReport();
+    if (report.runs == 0 || report.objectsPacked < 100 ||
+        report.bytesSaved <= 0) {
+      throw runtime_error("Expect loose objects to be packed");
+    }
+    r->setMaintenanceScheduler(nullptr);
+  }
+  checkFiles(r.get(), 30, 5);
+
+  // Small packs are merged into one.
+  MaintenanceScheduler scheduler(r.get(), 10, 3, 1024 * 1024,
+                                 chrono::hours(1));
+  for (int i = 30; i < 33; ++i) {
+    commitFiles(r.get(), i, 5);
+    scheduler.runOnce();
+  }
+  auto report = scheduler.getReport();
+  if (report.packsConsolidated < 3) {
+    throw runtime_error("Expect small packs to be consolidated");
+  }
+  checkFiles(r.get(), 33, 5);
+}
+
+main() {
+  testMaintenance();
+}
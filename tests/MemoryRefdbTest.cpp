@@ -0,0 +1,230 @@
+#include "Wrapper.h"
+#include "TestUtils.h"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace libgit2pp;
+
+const string root("/tmp/testMemoryRefdb");
+const string gitDir(root + "/.git");
+const string branch("refs/heads/master");
+
+string commitFile(Repository* r, int i) {
+  unordered_map<string, string> addedFiles;
+  addedFiles["f" + to_string(i)] = "contents " + to_string(i);
+  string id = r->commit(
+      "HEAD",
+      "My Name",
+      "my.name@gmail.com",
+      "Commit " + to_string(i),
+      addedFiles,
+      unordered_set<string>());
+  if (id.empty()) {
+    throw runtime_error("Fails to create a commit");
+  }
+  return id;
+}
+
+// The commit @param name points to in files, or "" if it's not there.
+string readRefFile(const string& name) {
+  ifstream in(gitDir + "/" + name);
+  string ret;
+  in >> ret;
+  return ret;
+}
+
+// The reflog entries of @param name in files, oldest first.
+vector<string> readReflog(const string& name) {
+  ifstream in(gitDir + "/logs/" + name);
+  vector<string> ret;
+  string line;
+  while (getline(in, line)) {
+    ret.push_back(line);
+  }
+  return ret;
+}
+
+bool endsWith(const string& s, const string& suffix) {
+  return s.size() >= suffix.size() &&
+      0 == s.compare(s.size() - suffix.size(), suffix.size(), suffix);
+}
+
+void testMemoryRefdb() {
+  setupRoot(root);
+
+  // Initializing libgit2 library.
+  Git2 git2;
+
+  string last;
+  {
+    unique_ptr<Repository> r;
+    try {
+      // Create a repository with a work tree, which keeps reflogs.
+      r.reset(new Repository(root, false));
+    } catch (const exception& ex) {
+      throw runtime_error("Fails to create a new git repository");
+    }
+    r->useMemoryRefdb(4);
+
+    // Commits chain in memory, and files are left alone until the
+    // batch is full.
+    for (int i = 0; i < 3; ++i) {
+      last = commitFile(r.get(), i);
+    }
+    if (!readRefFile(branch).empty()) {
+      throw runtime_error("Expect the branch to be kept in memory");
+    }
+    git_oid id;
+    if (0 != git_reference_name_to_id(&id, r->get(), "HEAD")) {
+      throw runtime_error("Fails to resolve HEAD");
+    }
+    char hex[GIT_OID_HEXSZ + 1];
+    if (last != git_oid_tostr(hex, sizeof(hex), &id)) {
+      throw runtime_error("Expect HEAD to point to the last commit");
+    }
+
+    // Updates are still checked against the value in memory.
+    git_oid stale;
+    git_oid_fromstr(&stale, last.c_str());
+    stale.id[0] ^= 1;
+    git_reference* out = nullptr;
+    if (GIT_EMODIFIED != git_reference_create_matching(
+            &out, r->get(), branch.c_str(), &id, 1, &stale, "stale")) {
+      throw runtime_error("Expect a stale update to fail");
+    }
+
+    if (!r->flushRefs()) {
+      throw runtime_error("Fails to write the references");
+    }
+    if (readRefFile(branch) != last) {
+      throw runtime_error("Expect the branch to be written");
+    }
+    // Each update is logged with its own message, on HEAD too.
+    for (auto& name : {branch, string("HEAD")}) {
+      auto log = readReflog(name);
+      if (log.size() != 3 || !endsWith(log[0], "commit (initial): Commit 0") ||
+          !endsWith(log[2], "commit: Commit 2") ||
+          log[2].find(last) == string::npos) {
+        throw runtime_error("Expect one reflog entry per update of " + name);
+      }
+    }
+
+    // A full batch is written on its own.
+    for (int i = 3; i < 7; ++i) {
+      last = commitFile(r.get(), i);
+    }
+    if (readRefFile(branch) != last) {
+      throw runtime_error("Expect a full batch to be written");
+    }
+    last = commitFile(r.get(), 7);
+  }
+
+  // Closing the repository writes the rest.
+  if (readRefFile(branch) != last) {
+    throw runtime_error("Expect the references to be written on close");
+  }
+  ifstream journal(gitDir + "/refs.journal");
+  if (!journal || journal.peek() != EOF) {
+    throw runtime_error("Expect an empty journal");
+  }
+}
+
+// Updates left in the journal are written when it's opened again.
+void testJournalReplay() {
+  Git2 git2;
+
+  {
+    ofstream journal(gitDir + "/refs.journal");
+    string id = readRefFile(branch);
+    journal << id << " refs/heads/topic\n";
+    journal << id << " refs/heads/signed\t1500000000\t60\t"
+            << "Other Name\tother@gmail.com\tbranch: Created\n";
+    journal << "- " << branch << "\n";
+    // A line torn by a crash.
+    journal << id << " refs/heads/torn";
+  }
+  Repository r(root);
+  r.useMemoryRefdb();
+  if (readRefFile("refs/heads/topic").empty()) {
+    throw runtime_error("Expect the journal to be replayed");
+  }
+  if (!readRefFile(branch).empty()) {
+    throw runtime_error("Expect deletions to be replayed");
+  }
+  auto log = readReflog("refs/heads/signed");
+  if (log.size() != 1 ||
+      !endsWith(log[0], "Other Name <other@gmail.com> 1500000000 +0100\t"
+                "branch: Created")) {
+    throw runtime_error("Expect replayed updates to keep their reflog entry");
+  }
+  if (!readRefFile("refs/heads/torn").empty()) {
+    throw runtime_error("Expect torn updates to be ignored");
+  }
+}
+
+// Updates a failed flush wrote already keep a single reflog entry when
+// the journal is replayed.
+void testPartialFlushReplay() {
+  Git2 git2;
+
+  string id = readRefFile("refs/heads/signed");
+  {
+    ofstream journal(gitDir + "/refs.journal");
+    journal << id << " refs/heads/signed\t1500000000\t60\t"
+            << "Other Name\tother@gmail.com\tbranch: Created\n";
+    journal << id << " refs/heads/signed\t1500000100\t60\t"
+            << "Other Name\tother@gmail.com\tbranch: Updated\n";
+  }
+  Repository r(root);
+  r.useMemoryRefdb();
+  auto log = readReflog("refs/heads/signed");
+  if (log.size() != 2 || !endsWith(log[0], "branch: Created") ||
+      !endsWith(log[1], "branch: Updated")) {
+    throw runtime_error("Expect written updates not to be logged again");
+  }
+}
+
+// Globs match nested references, as they do in files.
+void testNestedRefs() {
+  Git2 git2;
+
+  Repository r(root);
+  r.useMemoryRefdb();
+  git_oid id;
+  if (0 != git_reference_name_to_id(&id, r.get(), "refs/heads/topic")) {
+    throw runtime_error("Fails to resolve a branch");
+  }
+  git_reference* out = nullptr;
+  if (0 != git_reference_create(&out, r.get(), "refs/heads/feature/x", &id,
+                                0, "nested")) {
+    throw runtime_error("Fails to create a nested branch");
+  }
+  git_reference_free(out);
+
+  git_reference_iterator* it = nullptr;
+  if (0 != git_reference_iterator_glob_new(&it, r.get(), "refs/heads/*")) {
+    throw runtime_error("Fails to list branches");
+  }
+  vector<string> names;
+  const char* name = nullptr;
+  while (0 == git_reference_next_name(&name, it)) {
+    names.push_back(name);
+  }
+  git_reference_iterator_free(it);
+  if (find(names.begin(), names.end(), "refs/heads/feature/x") ==
+      names.end()) {
+    throw runtime_error("Expect globs to match nested references");
+  }
+}
+
+main() {
+  testMemoryRefdb();
+  testJournalReplay();
+  testPartialFlushReplay();
+  testNestedRefs();
+}
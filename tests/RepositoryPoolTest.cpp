@@ -0,0 +1,109 @@
+#include "RepositoryPool.h"
+#include "TestUtils.h"
+
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace libgit2pp;
+
+const int threads = 4;
+const int commitsPerThread = 10;
+
+void testRepositoryPool() {
+  const string root("/tmp/testRepositoryPool");
+  setupRoot(root);
+
+  // Initializing libgit2 library.
+  Git2 git2;
+
+  try {
+    // Create a bare repository.
+    Repository r(root, true);
+  } catch (const exception& ex) {
+    throw runtime_error("Fails to create a new git repository");
+  }
+
+  RepositoryPool pool(root);
+  vector<thread> writers;
+  vector<bool> failed(threads, false);
+  for (int t = 0; t < threads; ++t) {
+    writers.emplace_back([&pool, &failed, t] {
+      string parent;
+      for (int i = 0; i < commitsPerThread; ++i) {
+        auto repo = pool.checkout();
+        string path = "t" + to_string(t) + "/f" + to_string(i);
+        unordered_map<string, string> addedFiles = { {path, path} };
+        parent = repo->commitMatching(
+            parent,
+            "HEAD",
+            "My Name",
+            "my.name@gmail.com",
+            "Pooled commit " + path,
+            addedFiles,
+            unordered_set<string>());
+        if (parent.empty()) {
+          failed[t] = true;
+          return;
+        }
+      }
+    });
+  }
+  for (auto& w : writers) {
+    w.join();
+  }
+  for (bool f : failed) {
+    if (f) {
+      throw runtime_error("Fails to commit from a pooled handle");
+    }
+  }
+
+  // Handles are returned to the pool.
+  if (pool.size() == 0 || pool.size() > threads) {
+    throw runtime_error("Expect handles back in the pool");
+  }
+
+  auto repo = pool.checkout();
+  for (int t = 0; t < threads; ++t) {
+    for (int i = 0; i < commitsPerThread; ++i) {
+      string path = "t" + to_string(t) + "/f" + to_string(i);
+      if (blobAt(repo.get(), path).empty()) {
+        throw runtime_error("Expect to find " + path);
+      }
+    }
+  }
+}
+
+// Handles freed when the pool is full leave the shared object database
+// usable by the others.
+void testFullPool() {
+  const string root("/tmp/testRepositoryPool");
+
+  // Initializing libgit2 library.
+  Git2 git2;
+
+  RepositoryPool pool(root, 1);
+  {
+    auto a = pool.checkout();
+    auto b = pool.checkout();
+    auto c = pool.checkout();
+  }
+  if (pool.size() != 1) {
+    throw runtime_error("Expect the pool to keep one handle");
+  }
+  for (int i = 0; i < 3; ++i) {
+    auto repo = pool.checkout();
+    auto other = pool.checkout();
+    unique_ptr<git_tree> tree(repo->getCommitTree(""));
+    if (tree.get() == nullptr || !repo->readFile("", "t0/f0")) {
+      throw runtime_error("Fails to read from a pooled handle");
+    }
+  }
+}
+
+main() {
+  testRepositoryPool();
+  testFullPool();
+}
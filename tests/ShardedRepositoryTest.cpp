@@ -0,0 +1,192 @@
+#include "ShardedRepository.h"
+#include "TestUtils.h"
+
+#include <map>
+#include <stdexcept>
+#include <string>
+
+#include <unistd.h>
+
+using namespace std;
+using namespace libgit2pp;
+
+const string root("/tmp/testShardedRepository");
+const size_t shards = 4;
+const int commits = 10;
+
+string pathOf(int commit, int i) {
+  return "dir" + to_string(i % 6) + "/f" + to_string(commit) + "_" +
+      to_string(i);
+}
+
+void testShardedRepository() {
+  setupRoot(root);
+
+  // Initializing libgit2 library.
+  Git2 git2;
+
+  map<string, string> files;
+  {
+    ShardedRepository r(root, shards);
+    for (int commit = 0; commit < commits; ++commit) {
+      unordered_map<string, string> addedFiles;
+      for (int i = 0; i < 12; ++i) {
+        addedFiles[pathOf(commit, i)] = pathOf(commit, i);
+      }
+      unordered_set<string> deletedFiles;
+      if (commit > 0) {
+        deletedFiles.insert(pathOf(commit - 1, 0));
+      }
+      if (r.commit("My Name", "my.name@gmail.com", "A sharded commit",
+                   addedFiles, deletedFiles).empty()) {
+        throw runtime_error("Fails to create a sharded commit");
+      }
+      for (auto& p : addedFiles) {
+        files[p.first] = p.second;
+      }
+      for (auto& p : deletedFiles) {
+        files.erase(p);
+      }
+    }
+
+    // Each file is in its shard only.
+    for (auto& p : files) {
+      git_oid oid;
+      git_odb_hash(&oid, p.second.data(), p.second.size(), GIT_OBJ_BLOB);
+      char hex[GIT_OID_HEXSZ + 1];
+      git_oid_tostr(hex, sizeof(hex), &oid);
+      for (size_t i = 0; i < shards; ++i) {
+        string id = blobAt(&r.shard(i), p.first);
+        if ((i == r.shardOf(p.first)) != (id == hex)) {
+          throw runtime_error("Unexpected shard of " + p.first);
+        }
+      }
+    }
+    if (!blobAt(&r.shard(r.shardOf(pathOf(0, 0))), pathOf(0, 0)).empty()) {
+      throw runtime_error("Expect deleted files to be gone");
+    }
+
+    // The manifest has a commit per sharded commit, pointing to the
+    // shard tips.
+    unique_ptr<git_reference> head(r.manifest().getHead());
+    unique_ptr<git_commit> c(
+        r.manifest().getCommit(git_reference_target(head.get())));
+    git_tree* tmpTree = nullptr;
+    if (c.get() == nullptr || 0 != git_commit_tree(&tmpTree, c.get())) {
+      throw runtime_error("Fails to get the manifest tree");
+    }
+    unique_ptr<git_tree> tree(tmpTree);
+    for (size_t i = 0; i < shards; ++i) {
+      string name = "shard-00" + to_string(i);
+      auto entry = git_tree_entry_byname(tree.get(), name.c_str());
+      git_oid tip;
+      if (entry == nullptr ||
+          git_tree_entry_filemode(entry) != GIT_FILEMODE_COMMIT ||
+          0 != git_reference_name_to_id(&tip, r.shard(i).get(), "HEAD") ||
+          !git_oid_equal(&tip, git_tree_entry_id(entry))) {
+        throw runtime_error("Expect the manifest to point to " + name);
+      }
+    }
+    int count = 1;
+    while (git_commit_parentcount(c.get()) > 0) {
+      c.reset(r.manifest().getCommit(git_commit_parent_id(c.get(), 0)));
+      ++count;
+    }
+    if (count != commits) {
+      throw runtime_error("Expect a manifest commit per sharded commit");
+    }
+  }
+
+  // The number of shards can't change.
+  bool thrown = false;
+  try {
+    ShardedRepository r(root, shards + 1);
+  } catch (const exception& ex) {
+    thrown = true;
+  }
+  if (!thrown) {
+    throw runtime_error("Expect another number of shards to be refused");
+  }
+}
+
+// Paths may be routed by any prefix.
+void testShardRouter() {
+  setupRoot(root);
+  Git2 git2;
+
+  ShardedRepository r(root, 2, [](const string& path, size_t shards) {
+    return path.compare(0, 4, "odd/") == 0 ? 1 : 0;
+  });
+  unordered_map<string, string> addedFiles = {
+    {"odd/a", "a"}, {"even/b", "b"}, {"c", "c"}
+  };
+  string routed = r.commit("My Name", "my.name@gmail.com", "A routed commit",
+                           addedFiles, unordered_set<string>());
+  if (routed.empty()) {
+    throw runtime_error("Fails to create a routed commit");
+  }
+  if (blobAt(&r.shard(1), "odd/a").empty() ||
+      blobAt(&r.shard(0), "even/b").empty() ||
+      blobAt(&r.shard(0), "c").empty()) {
+    throw runtime_error("Expect files to follow the router");
+  }
+
+  // Nothing moves, so the manifest doesn't either.
+  if (r.commit("My Name", "my.name@gmail.com", "An empty commit",
+               unordered_map<string, string>(),
+               unordered_set<string>()) != routed) {
+    throw runtime_error("Expect no manifest commit without changes");
+  }
+}
+
+// A failed shard rolls the others back, and the manifest stays the same.
+void testShardRollback() {
+  setupRoot(root);
+  Git2 git2;
+
+  ShardedRepository r(root, 3, [](const string& path, size_t shards) {
+    return path[0] - 'a';
+  });
+  string first = r.commit("My Name", "my.name@gmail.com", "First",
+                          { {"a/x", "1"}, {"b/x", "1"} },
+                          unordered_set<string>());
+  git_oid tip0, tip1;
+  if (first.empty() || !r.shard(0).readReference("HEAD", &tip0) ||
+      !r.shard(1).readReference("HEAD", &tip1)) {
+    throw runtime_error("Fails to create a sharded commit");
+  }
+
+  // The branch of shard 1 is locked, so it can't move.
+  string lock = root + "/shard-001/refs/heads/master.lock";
+  writeToFile(lock, "");
+  if (!r.commit("My Name", "my.name@gmail.com", "Second",
+                { {"a/x", "2"}, {"b/x", "2"}, {"c/x", "2"} },
+                unordered_set<string>()).empty()) {
+    throw runtime_error("Expect a sharded commit with a failed shard to fail");
+  }
+  git_oid tip, head;
+  if (!r.shard(0).readReference("HEAD", &tip) || !git_oid_equal(&tip, &tip0) ||
+      !r.shard(1).readReference("HEAD", &tip) || !git_oid_equal(&tip, &tip1) ||
+      r.shard(2).readReference("HEAD", &tip)) {
+    throw runtime_error("Expect the shards rolled back");
+  }
+  char hex[GIT_OID_HEXSZ + 1];
+  if (!r.manifest().readReference("HEAD", &head) ||
+      first != git_oid_tostr(hex, sizeof(hex), &head)) {
+    throw runtime_error("Expect the manifest left unchanged");
+  }
+
+  unlink(lock.c_str());
+  if (r.commit("My Name", "my.name@gmail.com", "Second",
+               { {"a/x", "2"}, {"b/x", "2"}, {"c/x", "2"} },
+               unordered_set<string>()).empty() ||
+      readHeadFile(&r.shard(2), "c/x") != "2") {
+    throw runtime_error("Fails to commit once the shard is unlocked");
+  }
+}
+
+main() {
+  testShardedRepository();
+  testShardRouter();
+  testShardRollback();
+}
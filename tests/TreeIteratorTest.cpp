@@ -0,0 +1,85 @@
+#include "TreeIterator.h"
+#include "TestUtils.h"
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace libgit2pp;
+
+const string root("/tmp/testTreeIterator");
+
+void testTreeIterator() {
+  setupRoot(root);
+
+  // Initializing libgit2 library.
+  Git2 git2;
+
+  unique_ptr<Repository> r;
+  try {
+    // Create a bare repository.
+    r.reset(new Repository(root, true));
+  } catch (const exception& ex) {
+    throw runtime_error("Fails to create a new git repository");
+  }
+
+  unordered_map<string, string> addedFiles = {
+    {"a/b/c", "1"}, {"a/b/d", "2"}, {"a/e", "3"}, {"f", "4"},
+    {"g/h/i/j", "5"},
+  };
+  if (r->commit("HEAD", "My Name", "my.name@gmail.com", "A testing commit",
+                addedFiles, unordered_set<string>()).empty()) {
+    throw runtime_error("Fails to create a commit");
+  }
+  unique_ptr<git_tree> tree(r->getCommitTree(""));
+  if (tree.get() == nullptr) {
+    throw runtime_error("Fails to get the tree of HEAD");
+  }
+
+  // Trees come before their entries, in the order of the tree.
+  vector<string> paths;
+  for (auto e : TreeIterator(r->get(), tree.get())) {
+    paths.push_back(e.path.to_string() + ":" + to_string(e.depth));
+  }
+  vector<string> expected = {
+    "a:0", "a/b:1", "a/b/c:2", "a/b/d:2", "a/e:1", "f:0", "g:0", "g/h:1",
+    "g/h/i:2", "g/h/i/j:3",
+  };
+  if (paths != expected) {
+    throw runtime_error("Unexpected walk of the tree");
+  }
+
+  // A folder, down to a depth.
+  paths.clear();
+  for (auto e : TreeIterator(r->get(), tree.get(), "a", 0)) {
+    paths.push_back(e.path.to_string());
+  }
+  if (paths != vector<string>({"a/b", "a/e"})) {
+    throw runtime_error("Unexpected walk of a folder");
+  }
+
+  // Skipped trees are not walked.
+  paths.clear();
+  for (TreeIterator it(r->get(), tree.get()); !it.done();) {
+    auto e = *it;
+    paths.push_back(e.path.to_string());
+    if (git_tree_entry_type(e.entry) == GIT_OBJ_TREE) {
+      it.skip();
+    } else {
+      ++it;
+    }
+  }
+  if (paths != vector<string>({"a", "f", "g"})) {
+    throw runtime_error("Expect skipped trees not to be walked");
+  }
+
+  if (!TreeIterator(r->get(), tree.get(), "f").done() ||
+      !TreeIterator(r->get(), tree.get(), "x/y").done()) {
+    throw runtime_error("Expect nothing to walk out of folders");
+  }
+}
+
+main() {
+  testTreeIterator();
+}
@@ -1,10 +1,12 @@
 #include "Wrapper.h"
 #include "TestUtils.h"
 
+#include <algorithm>
 #include <stdexcept>
 #include <sstream>
 #include <string>
 #include <memory>
+#include <vector>
 
 #include <unistd.h>
 
@@ -76,6 +78,140 @@ void testCreateNewTree() {
   }
 }
 
+// Trees built in parallel must be the same as trees built serially.
+void testParallelTree() {
+  const string root("/tmp/testParallelTree");
+  setupRoot(root);
+
+  // Initializing libgit2 library.
+  Git2 git2;
+
+  unique_ptr<Repository> r;
+  try {
+    r = make_unique<Repository>(root, true);
+  } catch (const exception& ex) {
+    throw runtime_error("Fails to create a new git repository");
+  }
+
+  // Enough files in enough top level directories to go parallel.
+  vector<git_oid> oids(1000);
+  unordered_map<string, git_oid*> addedFiles;
+  for (int i = 0; i < oids.size(); ++i) {
+    stringstream path, data;
+    path << "dir" << i % 20 << "/sub" << i % 7 << "/file" << i;
+    data << "contents of file " << i;
+    if (!r->createBlobFromBuffer(data.str(), &oids[i])) {
+      throw runtime_error("Fails to create an object in git");
+    }
+    addedFiles[path.str()] = &oids[i];
+  }
+  unordered_set<string> deletedFiles;
+
+  git_oid serial;
+  if (!r->createTreeUsingExistingTree(
+          &serial, "", addedFiles, deletedFiles)) {
+    throw runtime_error("Fails to create a tree serially");
+  }
+
+  r->setParallelism(4);
+  git_oid parallel;
+  if (!r->createTreeUsingExistingTree(
+          &parallel, "", addedFiles, deletedFiles)) {
+    throw runtime_error("Fails to create a tree in parallel");
+  }
+
+  if (0 != git_oid_cmp(&serial, &parallel)) {
+    throw runtime_error("Expect the same tree from parallel building");
+  }
+}
+
+void testDiffTrees() {
+  const string root("/tmp/testDiffTrees");
+  setupRoot(root);
+
+  // Initializing libgit2 library.
+  Git2 git2;
+
+  unique_ptr<Repository> r;
+
+  // Create a bare repository.
+  try {
+    r = make_unique<Repository>(root, true);
+  } catch (const exception& ex) {
+    throw runtime_error("Fails to create a new git repository");
+  }
+
+  unordered_map<string, string> addedFiles;
+  for (int i = 0; i < 100; ++i) {
+    addedFiles["d" + to_string(i % 10) + "/f" + to_string(i)] = to_string(i);
+  }
+  addedFiles["x"] = "file";
+  string first = r->commit("HEAD", "My Name", "my.name@gmail.com",
+                           "A testing commit", addedFiles,
+                           unordered_set<string>());
+
+  // A modified file, an added and a deleted one, a new folder, and a
+  // file turned into a folder.
+  addedFiles = {
+    {"d1/f1", "changed"}, {"d2/new", "new"}, {"e/g", "g"},
+    {"x/w", "now a folder"},
+  };
+  unordered_set<string> deletedFiles = {"d3/f3", "x"};
+  string second = r->commit("HEAD", "My Name", "my.name@gmail.com",
+                            "A testing commit", addedFiles, deletedFiles);
+  if (first.empty() || second.empty()) {
+    throw runtime_error("Fails to create a commit");
+  }
+
+  vector<TreeChange> changes;
+  if (!r->diffTrees(first, second, &changes)) {
+    throw runtime_error("Fails to diff trees");
+  }
+  vector<string> found;
+  for (auto& c : changes) {
+    const char* types[] = {"A ", "M ", "D "};
+    found.push_back(types[c.type] + c.path);
+    bool hasOld = !git_oid_iszero(&c.oldId);
+    bool hasNew = !git_oid_iszero(&c.newId);
+    if (hasOld != (c.type != TreeChange::Added) ||
+        hasNew != (c.type != TreeChange::Deleted)) {
+      throw runtime_error("Unexpected object IDs of " + c.path);
+    }
+  }
+  sort(found.begin(), found.end());
+  vector<string> expected = {
+    "A d2/new", "A e/g", "A x/w", "D d3/f3", "D x", "M d1/f1",
+  };
+  if (found != expected) {
+    throw runtime_error("Unexpected changes between trees");
+  }
+
+  // The other way, a folder turns into a file.
+  changes.clear();
+  if (!r->diffTrees(second, first, &changes)) {
+    throw runtime_error("Fails to diff trees");
+  }
+  found.clear();
+  for (auto& c : changes) {
+    const char* types[] = {"A ", "M ", "D "};
+    found.push_back(types[c.type] + c.path);
+  }
+  sort(found.begin(), found.end());
+  expected = {
+    "A d3/f3", "A x", "D d2/new", "D e/g", "D x/w", "M d1/f1",
+  };
+  if (found != expected) {
+    throw runtime_error("Unexpected changes between reversed trees");
+  }
+
+  changes.clear();
+  if (!r->diffTrees(second, "", &changes) || !changes.empty()) {
+    throw runtime_error("Expect no change between a commit and itself");
+  }
+}
+
 main() {
   testCreateNewTree();
+  testParallelTree();
+  testDiffTrees();
 }
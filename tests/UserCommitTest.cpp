@@ -2,8 +2,12 @@
 #include "TestUtils.h"
 #include <stdexcept>
 #include <unordered_map>
+#include <vector>
 #include <iostream>
 
+#include <dirent.h>
+#include <unistd.h>
+
 using namespace std;
 using namespace libgit2pp;
 
@@ -42,6 +46,16 @@ void testUserCommit() {
     throw runtime_error("Fails to create a commit");
   }
 
+  // "README" and "a/README" have the same contents.
+  auto& stats = r->getLastCommitStats();
+  if (stats.blobsWritten != 4 || stats.blobsDeduplicated != 1) {
+    throw runtime_error("Expect duplicate contents to be written once");
+  }
+  // The root, "a", "a/b" and "x".
+  if (stats.treesWritten != 4) {
+    throw runtime_error("Unexpected number of trees written");
+  }
+
   unordered_map<string, string> addedFiles2 = {
     {"README", "hello, world abc"},
     {"a/Main.cpp", "void main() {}"},
@@ -63,6 +77,373 @@ void testUserCommit() {
   }
 }
 
+// Commits from another handle move the ref behind the back of the
+// first handle, whose cached trees must not be reused.
+void testCommitAfterRefMoved() {
+  const string root("/tmp/testCommitAfterRefMoved");
+  setupRoot(root.c_str());
+
+  // Initializing libgit2 library.
+  Git2 git2;
+  unique_ptr<Repository> r, other;
+
+  try {
+    // Create a bare repository and open it a second time.
+    r.reset(new Repository(root, true));
+    other.reset(new Repository(root));
+  } catch (const exception& ex) {
+    throw runtime_error("Fails to create a new git repository");
+  }
+
+  auto commit = [](Repository* repo, const string& path, const string& data) {
+    unordered_map<string, string> addedFiles = { {path, data} };
+    string id = repo->commit(
+        "HEAD",
+        "My Name",
+        "my.name@gmail.com",
+        "A testing commit",
+        addedFiles,
+        unordered_set<string>());
+    if (id.empty()) {
+      throw runtime_error("Fails to create a commit");
+    }
+  };
+
+  commit(r.get(), "a/b/Foo.h", "struct Foo {};");
+  commit(other.get(), "a/b/Bar.h", "struct Bar {};");
+  commit(r.get(), "a/b/Baz.h", "struct Baz {};");
+
+  // All three files must be in the tree of HEAD.
+  for (auto path : {"a/b/Foo.h", "a/b/Bar.h", "a/b/Baz.h"}) {
+    if (blobAt(r.get(), path).empty()) {
+      throw runtime_error(string("Expect to find ") + path);
+    }
+  }
+}
+
+// A commit based on a stale parent is rebased onto the new tip unless
+// the same paths were changed.
+void testCommitMatching() {
+  const string root("/tmp/testCommitMatching");
+  setupRoot(root.c_str());
+
+  // Initializing libgit2 library.
+  Git2 git2;
+  unique_ptr<Repository> r;
+
+  try {
+    // Create a bare repository.
+    r.reset(new Repository(root, true));
+  } catch (const exception& ex) {
+    throw runtime_error("Fails to create a new git repository");
+  }
+
+  auto commit = [&r](const string& parent, const string& path,
+                     const string& data) {
+    unordered_map<string, string> addedFiles = { {path, data} };
+    return r->commitMatching(
+        parent,
+        "HEAD",
+        "My Name",
+        "my.name@gmail.com",
+        "A testing commit",
+        addedFiles,
+        unordered_set<string>());
+  };
+
+  string base = commit("", "a/b/Foo.h", "struct Foo {};");
+  if (base.empty()) {
+    throw runtime_error("Fails to create a root commit");
+  }
+  string tip = commit(base, "a/b/Bar.h", "struct Bar {};");
+  if (tip.empty()) {
+    throw runtime_error("Fails to create a commit");
+  }
+
+  // A disjoint change on the stale parent lands on top of the tip.
+  string id = commit(base, "a/c/Baz.h", "struct Baz {};");
+  if (id.empty()) {
+    throw runtime_error("Fails to rebase a commit");
+  }
+  git_oid oid;
+  git_oid_fromstr(&oid, id.c_str());
+  unique_ptr<git_commit> c(r->getCommit(&oid));
+  char hex[GIT_OID_HEXSZ + 1];
+  git_oid_tostr(hex, sizeof(hex), git_commit_parent_id(c.get(), 0));
+  if (tip != hex) {
+    throw runtime_error("Expect the rebased commit on top of the tip");
+  }
+
+  // A change of a path changed since the parent conflicts.
+  if (!commit(base, "a/b/Bar.h", "struct Bar2 {};").empty()) {
+    throw runtime_error("Expect a conflicting commit to fail");
+  }
+
+  // The blob of the rejected commit is unreachable, and may be pruned.
+  string data("struct Bar2 {};");
+  git_odb_hash(&oid, data.data(), data.size(), GIT_OBJ_BLOB);
+  git_oid_tostr(hex, sizeof(hex), &oid);
+  string loose = root + "/objects/" + string(hex, 2) + "/" + (hex + 2);
+  if (0 != unlink(loose.c_str())) {
+    throw runtime_error("Expect the blob of the rejected commit");
+  }
+  if (commit(id, "a/b/Bar.h", data).empty()) {
+    throw runtime_error("Fails to create a commit");
+  }
+  unique_ptr<git_odb> odb(r->getOdb());
+  if (!git_odb_exists(odb.get(), &oid)) {
+    throw runtime_error("Expect a pruned blob to be written again");
+  }
+}
+
+// Count the loose objects and the packs of the repository at @param root.
+void countObjects(const string& root, size_t* loose, size_t* packs) {
+  *loose = *packs = 0;
+  string objects = root + "/objects/";
+  unique_ptr<DIR, int (*)(DIR*)> dir(opendir(objects.c_str()), closedir);
+  while (auto e = readdir(dir.get())) {
+    string name = e->d_name;
+    if (name.size() != 2 || name == "..") {
+      continue;
+    }
+    unique_ptr<DIR, int (*)(DIR*)> sub(
+        opendir((objects + name).c_str()), closedir);
+    while (auto f = readdir(sub.get())) {
+      *loose += (f->d_name[0] != '.');
+    }
+  }
+  unique_ptr<DIR, int (*)(DIR*)> pack(
+      opendir((objects + "pack").c_str()), closedir);
+  while (auto f = readdir(pack.get())) {
+    string name = f->d_name;
+    *packs += (name.size() > 5 && name.substr(name.size() - 5) == ".pack");
+  }
+}
+
+// Objects of a batch of commits are written as one pack.
+void testBatchCommit() {
+  const string root("/tmp/testBatchCommit");
+  setupRoot(root.c_str());
+
+  // Initializing libgit2 library.
+  Git2 git2;
+  unique_ptr<Repository> r;
+
+  try {
+    // Create a bare repository.
+    r.reset(new Repository(root, true));
+  } catch (const exception& ex) {
+    throw runtime_error("Fails to create a new git repository");
+  }
+
+  r->beginBatch();
+  for (int i = 0; i < 20; ++i) {
+    string path = "a/b" + to_string(i % 3) + "/f" + to_string(i);
+    unordered_map<string, string> addedFiles = { {path, path} };
+    string id = r->commit(
+        "HEAD",
+        "My Name",
+        "my.name@gmail.com",
+        "A batched commit",
+        addedFiles,
+        unordered_set<string>());
+    if (id.empty()) {
+      throw runtime_error("Fails to create a batched commit");
+    }
+  }
+
+  size_t loose, packs;
+  countObjects(root, &loose, &packs);
+  if (loose != 0 || packs != 0) {
+    throw runtime_error("Expect no objects written before the flush");
+  }
+  // References never point to objects only kept in memory.
+  {
+    Repository before(root);
+    unique_ptr<git_reference> head(before.getHead());
+    if (head.get() != nullptr) {
+      throw runtime_error("Expect HEAD to move once the batch is written");
+    }
+  }
+  if (!r->endBatch()) {
+    throw runtime_error("Fails to flush the batch");
+  }
+  countObjects(root, &loose, &packs);
+  if (loose != 0 || packs != 1) {
+    throw runtime_error("Expect the batch written as one pack");
+  }
+
+  // Another handle reads the objects of the batch.
+  Repository other(root);
+  if (blobAt(&other, "a/b1/f19").empty()) {
+    throw runtime_error("Expect to find a/b1/f19");
+  }
+}
+
+
+// Commits are chained the same way whatever their durability.
+void testDurability() {
+  const string root("/tmp/testDurability");
+
+  // Initializing libgit2 library.
+  Git2 git2;
+
+  for (auto durability :
+       {Durability::None, Durability::Group, Durability::Strict}) {
+    setupRoot(root.c_str());
+    Repository r(root, true);
+    r.setDurability(durability);
+    string last;
+    for (int i = 0; i < 5; ++i) {
+      unordered_map<string, string> addedFiles = {
+        {"d/f" + to_string(i), to_string(i)}
+      };
+      last = r.commit(
+          "HEAD",
+          "My Name",
+          "my.name@gmail.com",
+          "A durable commit",
+          addedFiles,
+          unordered_set<string>());
+      if (last.empty()) {
+        throw runtime_error("Fails to create a durable commit");
+      }
+    }
+
+    // Another handle sees the last commit and its ancestors.
+    Repository other(root);
+    unique_ptr<git_reference> head(other.getHead());
+    auto tip = git_reference_target(head.get());
+    char hex[GIT_OID_HEXSZ + 1];
+    if (last != git_oid_tostr(hex, sizeof(hex), tip)) {
+      throw runtime_error("Expect HEAD to point to the last commit");
+    }
+    unique_ptr<git_commit> c(other.getCommit(tip));
+    size_t count = 1;
+    while (git_commit_parentcount(c.get()) > 0) {
+      c.reset(other.getCommit(git_commit_parent_id(c.get(), 0)));
+      ++count;
+    }
+    if (count != 5) {
+      throw runtime_error("Expect 5 commits");
+    }
+  }
+}
+
+// The reflog has the summary of each commit, like git writes it.
+void testReflogMessages() {
+  const string root("/tmp/testReflogMessages");
+  setupRoot(root.c_str());
+
+  // Initializing libgit2 library.
+  Git2 git2;
+
+  // Bare repositories keep no reflog by default.
+  Repository r(root, false);
+  auto commit = [&r](const string& message) {
+    unordered_map<string, string> addedFiles = { {"README", message} };
+    if (r.commit("HEAD", "My Name", "my.name@gmail.com", message,
+                 addedFiles, unordered_set<string>()).empty()) {
+      throw runtime_error("Fails to create a commit");
+    }
+  };
+  commit("A testing commit");
+  commit("  A summary\n\nAnd a body.\n");
+  // Batched commits get an entry each too.
+  r.beginBatch();
+  commit("Batched 1");
+  commit("Batched 2");
+  if (!r.endBatch()) {
+    throw runtime_error("Fails to flush the batch");
+  }
+
+  git_reflog* tmp = nullptr;
+  if (0 != git_reflog_read(&tmp, r.get(), "refs/heads/master")) {
+    throw runtime_error("Fails to read the reflog");
+  }
+  unique_ptr<git_reflog, void (*)(git_reflog*)> reflog(tmp, git_reflog_free);
+  vector<string> expected = {
+    "commit: Batched 2",
+    "commit: Batched 1",
+    "commit: A summary",
+    "commit (initial): A testing commit",
+  };
+  if (git_reflog_entrycount(reflog.get()) != expected.size()) {
+    throw runtime_error("Unexpected reflog entries");
+  }
+  for (size_t i = 0; i < expected.size(); ++i) {
+    if (expected[i] != git_reflog_entry_message(
+            git_reflog_entry_byindex(reflog.get(), i))) {
+      throw runtime_error("Unexpected reflog message " + expected[i]);
+    }
+  }
+}
+
+// Workers of a Strict handle don't turn syncing off for it.
+void testStrictWorkers() {
+  const string root("/tmp/testStrictWorkers");
+  setupRoot(root.c_str());
+
+  // Initializing libgit2 library.
+  Git2 git2;
+
+  {
+    Repository r(root, true);
+    r.setDurability(Durability::Strict);
+    r.setParallelism(3);
+    r.setParallelism(0);
+    if (!syncsAllWrites()) {
+      throw runtime_error("Expect writes synced while a handle is Strict");
+    }
+  }
+  if (syncsAllWrites()) {
+    throw runtime_error("Expect writes not synced once no handle is Strict");
+  }
+}
+
+// With group durability, references kept in memory and written to files
+// on every update still wait for the pack of the batch.
+void testGroupBatch() {
+  const string root("/tmp/testGroupBatch");
+  setupRoot(root.c_str());
+
+  // Initializing libgit2 library.
+  Git2 git2;
+
+  Repository r(root, true);
+  r.setDurability(Durability::Group);
+  r.useMemoryRefdb(1);
+  r.beginBatch();
+  for (int i = 0; i < 3; ++i) {
+    unordered_map<string, string> addedFiles = {
+      {"d/f" + to_string(i), to_string(i)}
+    };
+    if (r.commit("HEAD", "My Name", "my.name@gmail.com", "A batched commit",
+                 addedFiles, unordered_set<string>()).empty()) {
+      throw runtime_error("Fails to create a batched commit");
+    }
+  }
+  if (0 == access((root + "/refs/heads/master").c_str(), F_OK)) {
+    throw runtime_error("Expect the branch written after the pack");
+  }
+  if (!r.endBatch()) {
+    throw runtime_error("Fails to flush the batch");
+  }
+  size_t loose, packs;
+  countObjects(root, &loose, &packs);
+  if (packs != 1 || blobAt(&r, "d/f2").empty() ||
+      0 != access((root + "/refs/heads/master").c_str(), F_OK)) {
+    throw runtime_error("Expect the branch written with the pack");
+  }
+}
+
 main() {
   testUserCommit();
+  testCommitAfterRefMoved();
+  testCommitMatching();
+  testBatchCommit();
+  testDurability();
+  testStrictWorkers();
+  testGroupBatch();
+  testReflogMessages();
 }